@@ -0,0 +1,128 @@
+#ifndef RT_SYCL_AABB_HPP
+#define RT_SYCL_AABB_HPP
+
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "rtweekend.hpp"
+#include "vec.hpp"
+
+/** Axis-aligned bounding box
+
+    This implements:
+
+        -
+   https://raytracing.github.io/books/RayTracingTheNextWeek.html#boundingvolumehierarchies/axis-alignedboundingboxes(aabbs)
+
+    A default constructed box is empty: merging it with any other box
+    gives that other box.
+*/
+struct aabb {
+  aabb() = default;
+
+  aabb(const point& a, const point& b)
+      : minimum { sycl::fmin(a, b) }
+      , maximum { sycl::fmax(a, b) } {}
+
+  /// Grow the box so that it contains the other box
+  aabb& merge(const aabb& other) {
+    minimum = sycl::fmin(minimum, other.minimum);
+    maximum = sycl::fmax(maximum, other.maximum);
+    return *this;
+  }
+
+  /// Grow the box so that it contains the point
+  aabb& merge(const point& p) {
+    minimum = sycl::fmin(minimum, p);
+    maximum = sycl::fmax(maximum, p);
+    return *this;
+  }
+
+  /// Make sure no side is thinner than delta, so that flat primitives such as
+  /// axis aligned rectangles still have a non-degenerate box
+  aabb& pad(real_t delta = 0.0001f) {
+    auto extent = maximum - minimum;
+    auto grow = [&](real_t e) { return e < delta ? delta / 2 : 0.0f; };
+    vec padding { grow(extent.x()), grow(extent.y()), grow(extent.z()) };
+    minimum -= padding;
+    maximum += padding;
+    return *this;
+  }
+
+  point centroid() const { return 0.5f * (minimum + maximum); }
+
+  /// Surface area, used as the cost metric when building the BVH
+  real_t surface_area() const {
+    auto e = maximum - minimum;
+    if (e.x() < 0 || e.y() < 0 || e.z() < 0)
+      return 0;
+    return 2 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+  }
+
+  /** Slab test of a ray against the box
+
+      \param[in] origin is the ray origin
+
+      \param[in] inv_dir is the component-wise inverse of the ray direction,
+      computed once per ray
+
+      \return true if the ray overlaps the box between min and max
+  */
+  bool hit(const point& origin, const vec& inv_dir, real_t min,
+           real_t max) const {
+    return clip(origin, inv_dir, min, max);
+  }
+
+  /** Slab test of a ray against the box, also giving where the ray is in
+      the box
+
+      \param[in,out] min and max are narrowed to the part of the ray inside
+      the box
+
+      \return true if the ray overlaps the box between min and max
+  */
+  bool clip(const point& origin, const vec& inv_dir, real_t& min,
+            real_t& max) const {
+    auto t0 = (minimum - origin) * inv_dir;
+    auto t1 = (maximum - origin) * inv_dir;
+    auto t_near = sycl::fmin(t0, t1);
+    auto t_far = sycl::fmax(t0, t1);
+    min = sycl::fmax(min, sycl::fmax(t_near.x(), sycl::fmax(t_near.y(),
+                                                            t_near.z())));
+    max = sycl::fmin(max, sycl::fmin(t_far.x(), sycl::fmin(t_far.y(),
+                                                           t_far.z())));
+    return min <= max;
+  }
+
+  /// Slab test of a packet of rays against the box
+  ///
+  /// \return true if at least one ray overlaps the box between min and its
+  /// own max
+  template <std::size_t N>
+  bool hit_any(const ray_packet<N>& rays, real_t min,
+               const typename ray_packet<N>::lanes& max) const {
+    bool any = false;
+    for (std::size_t i = 0; i < N; ++i) {
+      auto slab = [&](real_t lo, real_t hi, real_t o, real_t inv_d,
+                      real_t& t_min, real_t& t_max) {
+        const auto t0 = (lo - o) * inv_d;
+        const auto t1 = (hi - o) * inv_d;
+        t_min = sycl::fmax(t_min, sycl::fmin(t0, t1));
+        t_max = sycl::fmin(t_max, sycl::fmax(t0, t1));
+      };
+      real_t t_min = min;
+      real_t t_max = max[i];
+      slab(minimum.x(), maximum.x(), rays.ox[i], rays.inv_dx[i], t_min, t_max);
+      slab(minimum.y(), maximum.y(), rays.oy[i], rays.inv_dy[i], t_min, t_max);
+      slab(minimum.z(), maximum.z(), rays.oz[i], rays.inv_dz[i], t_min, t_max);
+      any |= t_min <= t_max;
+    }
+    return any;
+  }
+
+  point minimum { infinity, infinity, infinity };
+  point maximum { -infinity, -infinity, -infinity };
+};
+
+inline aabb surrounding_box(aabb a, const aabb& b) { return a.merge(b); }
+
+#endif
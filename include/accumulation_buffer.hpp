@@ -0,0 +1,350 @@
+#ifndef RT_SYCL_ACCUMULATION_BUFFER_HPP
+#define RT_SYCL_ACCUMULATION_BUFFER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "instrumentation.hpp"
+#include "render_parameters.hpp"
+#include "rtweekend.hpp"
+#include "scene_identity.hpp"
+#include "sycl.hpp"
+#include "vec.hpp"
+
+/** Running statistics of the samples of a pixel
+
+    The mean and variance of the sample luminance are updated with Welford's
+    algorithm, which is numerically stable in single precision.
+*/
+struct pixel_statistics {
+  /// Account for a new sample computed by tracing path_length rays
+  void add(const color& c, std::uint32_t path_length) {
+    rays += path_length;
+    auto luminance = 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+    ++count;
+    auto delta = luminance - mean;
+    mean += delta / count;
+    m2 += delta * (luminance - mean);
+  }
+
+  /** Tell whether the estimated standard error of the pixel mean is below
+      threshold, relatively to the pixel luminance
+
+      Very dark pixels are compared to a minimum luminance instead, since
+      their relative error is meaningless.
+  */
+  bool converged(float threshold, std::uint32_t min_samples) const {
+    if (count < min_samples || count < 2)
+      return false;
+    auto variance_of_mean = m2 / ((count - 1) * static_cast<float>(count));
+    auto tolerance = threshold * sycl::fmax(mean, 0.01f);
+    return variance_of_mean <= tolerance * tolerance;
+  }
+
+  /// Number of samples of the pixel
+  std::uint32_t count = 0;
+  float mean = 0;
+  /// Sum of the squared distances to the mean
+  float m2 = 0;
+  /// Number of rays traced for the samples of the pixel, not counting the
+  /// rays towards the lights
+  std::uint32_t rays = 0;
+};
+
+/** Settings of adaptive sampling
+
+    Once a pixel has at least min_samples samples and its estimated error is
+    below threshold, it stops being sampled. The samples it would have taken
+    are given to the pixels still being sampled, up to max_boost times their
+    normal number of samples per pass.
+*/
+struct adaptive_sampling {
+  /// Relative standard error target, 0 to disable adaptive sampling
+  float threshold = 0;
+  std::uint32_t min_samples = 32;
+  std::uint32_t max_boost = 8;
+
+  bool enabled() const { return threshold > 0; }
+
+  /** Average number of rounds of samples of an active pixel in a pass, so
+      that the active pixels render the samples of the converged ones
+
+      Each active pixel renders the integer part of rounds and one more round
+      with a probability of the fractional part.
+  */
+  float boost(std::uint32_t nb_pixels, std::uint32_t active_pixels) const {
+    return enabled() ? std::clamp(static_cast<float>(nb_pixels) /
+                                      std::max(active_pixels, 1u),
+                                  1.0f, static_cast<float>(max_boost))
+                     : 1.0f;
+  }
+};
+
+/** Persistent state of a progressive render
+
+    Each rendering pass adds its samples to the per-pixel sum and continues
+    the per-pixel random number sequence, so that running N passes of k
+    samples gives the same image as one pass of N*k samples.
+
+    Per-pixel statistics are kept to drive adaptive sampling, so the pixels
+    may end up with different numbers of samples.
+
+    The whole state can be saved to a checkpoint file and loaded back later to
+    resume an interrupted render.
+
+    With buildparams::use_instrumentation, the per-pixel counters of the
+    renderer are also kept, but not saved: they count the work of this run.
+*/
+class accumulation_buffer {
+  static constexpr char magic[8] = { 'S', 'Y', 'R', 'T', 'A', 'C', 'C', '4' };
+
+  struct header {
+    char magic[8];
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t sample_count;
+    std::uint32_t active_pixels;
+    /// The parameters of the estimates, which a resumed render must keep
+    std::uint32_t samples;
+    std::uint32_t depth;
+    std::uint32_t roulette_depth;
+    std::uint32_t light_sampling;
+    /// The scene file, whose path follows the header
+    scene_identity scene;
+  };
+
+  /// The header of the current state, false if the scene file cannot be
+  /// read
+  bool make_header(const render_parameters& params, const char* scene_file,
+                   header& h, std::string& path) const {
+    h = { {},
+          static_cast<std::uint32_t>(width()),
+          static_cast<std::uint32_t>(height()),
+          sample_count,
+          active_pixels,
+          static_cast<std::uint32_t>(params.samples),
+          static_cast<std::uint32_t>(params.depth),
+          static_cast<std::uint32_t>(params.roulette_depth),
+          params.light_sampling,
+          {} };
+    std::memcpy(h.magic, magic, sizeof(magic));
+    return scene_identity::of(scene_file, h.scene, path);
+  }
+
+ public:
+  accumulation_buffer(std::size_t width, std::size_t height)
+      : sum { sycl::range<2>(height, width) }
+      , rng_state { sycl::range<2>(height, width) }
+      , statistics { sycl::range<2>(height, width) }
+      , counters { buildparams::use_instrumentation
+                       ? sycl::range<2>(height, width)
+                       : sycl::range<2>(1, 1) } {
+    clear();
+  }
+
+  /// Reset to no sample and seed the random generator of each pixel
+  void clear() {
+    sample_count = 0;
+    active_pixels = width() * height();
+    auto sum_acc = sum.get_access<sycl::access::mode::discard_write>();
+    auto rng_acc = rng_state.get_access<sycl::access::mode::discard_write>();
+    auto stats_acc = statistics.get_access<sycl::access::mode::discard_write>();
+    for (std::size_t y = 0; y < height(); ++y)
+      for (std::size_t x = 0; x < width(); ++x) {
+        sum_acc[y][x] = color { 0.0f, 0.0f, 0.0f };
+        rng_acc[y][x] = std::hash<std::size_t> {}(y * width() + x);
+        stats_acc[y][x] = pixel_statistics {};
+      }
+    auto counters_acc =
+        counters.get_access<sycl::access::mode::discard_write>();
+    for (std::size_t y = 0; y < counters.get_range()[0]; ++y)
+      for (std::size_t x = 0; x < counters.get_range()[1]; ++x)
+        counters_acc[y][x] = instrumentation::pixel_counters {};
+  }
+
+  std::size_t width() const { return sum.get_range()[1]; }
+  std::size_t height() const { return sum.get_range()[0]; }
+
+  /// Write the state to a checkpoint file
+  bool save(const char* file_name, const render_parameters& params,
+            const char* scene_file) {
+    header h;
+    std::string path;
+    if (!make_header(params, scene_file, h, path)) {
+      std::cerr << "ERROR: Could not read scene file '" << scene_file
+                << "' to write checkpoint '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    // Write to a temporary file first so that a job killed while saving does
+    // not lose the previous checkpoint
+    const auto tmp_name = std::string { file_name } + ".tmp";
+    std::ofstream out { tmp_name, std::ios::binary };
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(path.data(), path.size());
+    auto sum_acc = sum.get_access<sycl::access::mode::read>();
+    auto rng_acc = rng_state.get_access<sycl::access::mode::read>();
+    auto stats_acc = statistics.get_access<sycl::access::mode::read>();
+    for (std::size_t y = 0; y < height(); ++y)
+      for (std::size_t x = 0; x < width(); ++x) {
+        const color c = sum_acc[y][x];
+        const float rgb[] = { c.x(), c.y(), c.z() };
+        out.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+      }
+    for (std::size_t y = 0; y < height(); ++y)
+      for (std::size_t x = 0; x < width(); ++x) {
+        const std::uint32_t s = rng_acc[y][x];
+        out.write(reinterpret_cast<const char*>(&s), sizeof(s));
+      }
+    for (std::size_t y = 0; y < height(); ++y)
+      for (std::size_t x = 0; x < width(); ++x) {
+        const pixel_statistics p = stats_acc[y][x];
+        out.write(reinterpret_cast<const char*>(&p), sizeof(p));
+      }
+    out.close();
+    if (!out || std::rename(tmp_name.c_str(), file_name) != 0) {
+      std::cerr << "ERROR: Could not write checkpoint file '" << file_name
+                << "'." << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /** Read back the state from a checkpoint file of the same image size,
+      render parameters and scene, so that the resumed passes add the same
+      estimates
+
+      \param[in] scene_file is nullptr for the built-in scene
+  */
+  bool load(const char* file_name, const render_parameters& params,
+            const char* scene_file) {
+    std::ifstream in { file_name, std::ios::binary };
+    header h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+        std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+      std::cerr << "ERROR: '" << file_name << "' is not a checkpoint file."
+                << std::endl;
+      return false;
+    }
+    if (h.width != width() || h.height != height()) {
+      std::cerr << "ERROR: Checkpoint '" << file_name << "' is " << h.width
+                << "x" << h.height << " but the image is " << width() << "x"
+                << height() << "." << std::endl;
+      return false;
+    }
+    header expected;
+    std::string path;
+    if (!make_header(params, scene_file, expected, path)) {
+      std::cerr << "ERROR: Could not read scene file '" << scene_file
+                << "' to resume checkpoint '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    if (h.samples != expected.samples || h.depth != expected.depth ||
+        h.roulette_depth != expected.roulette_depth ||
+        h.light_sampling != expected.light_sampling) {
+      std::cerr << "ERROR: Checkpoint '" << file_name << "' was rendered with "
+                << h.samples << " samples per pass, a depth of " << h.depth
+                << ", Russian roulette after " << h.roulette_depth
+                << " bounces and light sampling "
+                << (h.light_sampling ? "on" : "off")
+                << ", which must be kept to resume it." << std::endl;
+      return false;
+    }
+    if (!h.scene.matches(in, expected.scene, path)) {
+      std::cerr << "ERROR: Checkpoint '" << file_name
+                << "' was rendered from another scene or version of it."
+                << std::endl;
+      return false;
+    }
+    std::vector<float> rgb(width() * height() * 3);
+    std::vector<std::uint32_t> states(width() * height());
+    std::vector<pixel_statistics> stats(width() * height());
+    in.read(reinterpret_cast<char*>(rgb.data()), rgb.size() * sizeof(float));
+    in.read(reinterpret_cast<char*>(states.data()),
+            states.size() * sizeof(std::uint32_t));
+    in.read(reinterpret_cast<char*>(stats.data()),
+            stats.size() * sizeof(pixel_statistics));
+    if (!in) {
+      std::cerr << "ERROR: Checkpoint '" << file_name << "' is truncated."
+                << std::endl;
+      return false;
+    }
+    auto sum_acc = sum.get_access<sycl::access::mode::discard_write>();
+    auto rng_acc = rng_state.get_access<sycl::access::mode::discard_write>();
+    auto stats_acc = statistics.get_access<sycl::access::mode::discard_write>();
+    for (std::size_t y = 0, i = 0; y < height(); ++y)
+      for (std::size_t x = 0; x < width(); ++x, ++i) {
+        sum_acc[y][x] = color { rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2] };
+        rng_acc[y][x] = states[i];
+        stats_acc[y][x] = stats[i];
+      }
+    sample_count = h.sample_count;
+    active_pixels = h.active_pixels;
+    return true;
+  }
+
+  /// Print the distribution of the number of samples per pixel and the
+  /// average path length
+  void print_sample_statistics(std::ostream& out) {
+    auto stats_acc = statistics.get_access<sycl::access::mode::read>();
+    std::uint64_t total = 0;
+    std::uint64_t total_rays = 0;
+    std::uint32_t min_count = UINT32_MAX, max_count = 0;
+    // Histogram by power of 2 of the number of samples
+    std::vector<std::size_t> histogram(33);
+    for (std::size_t y = 0; y < height(); ++y)
+      for (std::size_t x = 0; x < width(); ++x) {
+        const std::uint32_t c = stats_acc[y][x].count;
+        total += c;
+        total_rays += stats_acc[y][x].rays;
+        min_count = std::min(min_count, c);
+        max_count = std::max(max_count, c);
+        int bucket = 0;
+        while ((std::uint64_t { 1 } << bucket) <= c)
+          ++bucket;
+        ++histogram[bucket];
+      }
+    const auto nb_pixels = width() * height();
+    out << "samples: " << total << " total, "
+        << static_cast<double>(total) / nb_pixels << " spp on average, "
+        << min_count << " min, " << max_count << " max, " << active_pixels
+        << " pixels not converged\n"
+        << "path length: " << static_cast<double>(total_rays) / total
+        << " rays per sample on average\n";
+    for (std::size_t b = 0; b < histogram.size(); ++b)
+      if (histogram[b])
+        out << "  spp in [" << (b ? std::uint64_t { 1 } << (b - 1) : 0)
+            << ", " << (std::uint64_t { 1 } << b) << "): " << histogram[b]
+            << " pixels\n";
+  }
+
+  /// Sum of the samples of each pixel
+  sycl::buffer<color, 2> sum;
+
+  /// State of the random generator of each pixel
+  sycl::buffer<std::uint32_t, 2> rng_state;
+
+  /// Number of samples and luminance statistics of each pixel
+  sycl::buffer<pixel_statistics, 2> statistics;
+
+  /// Counters of the work done for each pixel, a single element without
+  /// instrumentation
+  sycl::buffer<instrumentation::pixel_counters, 2> counters;
+
+  /// Number of samples per pixel of the passes so far, as if no pixel had
+  /// stopped early
+  std::uint32_t sample_count = 0;
+
+  /// Number of pixels not converged at the end of the last pass
+  std::uint32_t active_pixels = 0;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef RT_SYCL_BLOCK_COMPRESSION_HPP
+#define RT_SYCL_BLOCK_COMPRESSION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "rtweekend.hpp"
+#include "vec.hpp"
+
+/** BC1 (DXT1) compression of RGB images
+
+    Each block of 4 x 4 texels is stored in 8 bytes: 2 RGB565 end points,
+    then a 2-bit index per texel, row by row, selecting either end point or
+    one of the 2 colors at 1/3 and 2/3 between them. This is a fixed rate of
+    4 bits per texel, 6 times less than 8-bit RGB, and any texel can be
+    decoded from its block alone.
+
+    The end points are stored with the first one greater than the second
+    one, which selects the 4-color mode of BC1, except for the blocks of a
+    single color.
+*/
+namespace bc1 {
+
+constexpr std::size_t block_size = 8;
+
+/// Quantize an 8-bit RGB color to RGB565
+inline std::uint16_t to_565(const float (&c)[3]) {
+  auto q = [](float v, int max) {
+    return static_cast<std::uint16_t>(
+        std::clamp(static_cast<int>(v * max / 255 + 0.5f), 0, max));
+  };
+  return q(c[0], 31) << 11 | q(c[1], 63) << 5 | q(c[2], 31);
+}
+
+/// Expand an RGB565 color to 8-bit components, as floats in [0, 255]
+inline color from_565(std::uint16_t c) {
+  const auto r = (c >> 11) & 31;
+  const auto g = (c >> 5) & 63;
+  const auto b = c & 31;
+  return { static_cast<real_t>(r << 3 | r >> 2),
+           static_cast<real_t>(g << 2 | g >> 4),
+           static_cast<real_t>(b << 3 | b >> 2) };
+}
+
+namespace detail {
+
+/// Choose the nearest of the 4 colors for each texel, returning the squared
+/// error and the indices
+inline float assign(const float (&texels)[16][3], std::uint16_t c0,
+                    std::uint16_t c1, std::uint32_t& indices) {
+  const auto e0 = from_565(c0);
+  const auto e1 = from_565(c1);
+  const color palette[4] = { e0, e1, (2 * e0 + e1) / 3, (e0 + 2 * e1) / 3 };
+  float error = 0;
+  indices = 0;
+  for (int t = 0; t < 16; ++t) {
+    float best = 3 * 256 * 256;
+    std::uint32_t index = 0;
+    for (std::uint32_t i = 0; i < 4; ++i) {
+      float d = 0;
+      for (int c = 0; c < 3; ++c) {
+        const auto diff = texels[t][c] - palette[i][c];
+        d += diff * diff;
+      }
+      if (d < best) {
+        best = d;
+        index = i;
+      }
+    }
+    error += best;
+    indices |= index << (2 * t);
+  }
+  return error;
+}
+
+/// Store the end points in 4-color order with their indices
+inline void store(std::uint16_t c0, std::uint16_t c1, std::uint32_t indices,
+                  std::uint8_t* out) {
+  if (c0 < c1) {
+    std::swap(c0, c1);
+    // Swap the end points in the indices: 0 <-> 1 and 2 <-> 3
+    indices ^= 0x55555555;
+  } else if (c0 == c1)
+    // 3-color mode, where index 0 is the only color equal to the end points
+    indices = 0;
+  out[0] = static_cast<std::uint8_t>(c0);
+  out[1] = static_cast<std::uint8_t>(c0 >> 8);
+  out[2] = static_cast<std::uint8_t>(c1);
+  out[3] = static_cast<std::uint8_t>(c1 >> 8);
+  for (int i = 0; i < 4; ++i)
+    out[4 + i] = static_cast<std::uint8_t>(indices >> (8 * i));
+}
+
+} // namespace detail
+
+/** Compress a block of 16 RGB texels, in row order
+
+    The end points are first the extreme texels along the principal axis of
+    the colors, then refined once by least squares from the chosen indices,
+    the refinement being kept if it reduces the error.
+
+    \param[out] out receives the block_size bytes of the block
+*/
+inline void compress(const float (&texels)[16][3], std::uint8_t* out) {
+  float mean[3] = {};
+  for (auto& t : texels)
+    for (int c = 0; c < 3; ++c)
+      mean[c] += t[c] / 16;
+  float cov[6] = {};
+  for (auto& t : texels) {
+    const float d[3] = { t[0] - mean[0], t[1] - mean[1], t[2] - mean[2] };
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+  // Principal axis by power iteration
+  float axis[3] = { 1, 1, 1 };
+  for (int i = 0; i < 8; ++i) {
+    const float next[3] = { cov[0] * axis[0] + cov[1] * axis[1] +
+                                cov[2] * axis[2],
+                            cov[1] * axis[0] + cov[3] * axis[1] +
+                                cov[4] * axis[2],
+                            cov[2] * axis[0] + cov[4] * axis[1] +
+                                cov[5] * axis[2] };
+    const auto norm =
+        std::max({ std::abs(next[0]), std::abs(next[1]), std::abs(next[2]) });
+    if (norm < 1e-6f)
+      break;
+    for (int c = 0; c < 3; ++c)
+      axis[c] = next[c] / norm;
+  }
+  int min = 0, max = 0;
+  float min_p = 0, max_p = 0;
+  for (int t = 0; t < 16; ++t) {
+    const auto p = texels[t][0] * axis[0] + texels[t][1] * axis[1] +
+                   texels[t][2] * axis[2];
+    if (t == 0 || p < min_p) {
+      min_p = p;
+      min = t;
+    }
+    if (t == 0 || p > max_p) {
+      max_p = p;
+      max = t;
+    }
+  }
+  std::uint16_t c0 = to_565(texels[max]);
+  std::uint16_t c1 = to_565(texels[min]);
+  std::uint32_t indices;
+  const auto error = detail::assign(texels, c0, c1, indices);
+
+  // Least squares end points for these indices: each texel is
+  // a * e0 + b * e1, with the weights of its index
+  constexpr float weight[4] = { 1, 0, 2.f / 3, 1.f / 3 };
+  float aa = 0, ab = 0, bb = 0, ax[3] = {}, bx[3] = {};
+  for (int t = 0; t < 16; ++t) {
+    const auto a = weight[(indices >> (2 * t)) & 3];
+    const auto b = 1 - a;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < 3; ++c) {
+      ax[c] += a * texels[t][c];
+      bx[c] += b * texels[t][c];
+    }
+  }
+  const auto det = aa * bb - ab * ab;
+  if (std::abs(det) > 1e-6f) {
+    float e0[3], e1[3];
+    for (int c = 0; c < 3; ++c) {
+      e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+      e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+    }
+    const auto r0 = to_565(e0);
+    const auto r1 = to_565(e1);
+    std::uint32_t refined_indices;
+    const auto refined_error =
+        detail::assign(texels, r0, r1, refined_indices);
+    if (refined_error < error) {
+      c0 = r0;
+      c1 = r1;
+      indices = refined_indices;
+    }
+  }
+  detail::store(c0, c1, indices, out);
+}
+
+/** Decode texel i, in row order, of a block
+
+    \return the color with components in [0, 255]
+*/
+inline color decode(const auto& data, std::size_t block, std::size_t i) {
+  const auto c0 = static_cast<std::uint16_t>(data[block] | data[block + 1] << 8);
+  const auto c1 =
+      static_cast<std::uint16_t>(data[block + 2] | data[block + 3] << 8);
+  const auto index = (data[block + 4 + i / 4] >> (2 * (i % 4))) & 3;
+  const auto e0 = from_565(c0);
+  const auto e1 = from_565(c1);
+  if (c0 <= c1)
+    // 3-color mode: the end points, their average and black
+    return index == 0   ? e0
+           : index == 1 ? e1
+           : index == 2 ? (e0 + e1) / 2
+                        : color { 0, 0, 0 };
+  // The weight of e0 for indices 0 to 3: 1, 0, 2/3, 1/3, as thirds
+  const auto w = static_cast<real_t>((0x1203 >> (4 * index)) & 3) * (1.f / 3);
+  return e1 + w * (e0 - e1);
+}
+
+} // namespace bc1
+
+#endif
@@ -1,58 +1,132 @@
 #ifndef BOX_HPP
 #define BOX_HPP
 
-#include "rectangle.hpp"
+#include <cstddef>
+
+#include "aabb.hpp"
+#include "hitable.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
 #include "rtweekend.hpp"
-#include "visit.hpp"
+#include "vec.hpp"
+
+/** This class implements an axis aligned cuboid
 
-/// This class implements a axis aligned cuboid using 6 rectangles
+    The box is only stored as its 2 corners, and intersected with the slab
+    method: the ray enters the box at the last of the 3 slabs it enters, and
+    leaves it at the first one it leaves. The normal and the texture
+    coordinates are only computed for that face, like those of the
+    rectangle with the same orientation.
+*/
 class box {
  public:
   box() = default;
 
   /// p0 = { x0, y0, z0 } and p1 = { x1, y1. z1 }
   /// where x0 <= x1, y0 <= y1 and z0 <= z1
-  box(const point& p0, const point& p1, const material_t& mat_type)
+  box(const point& p0, const point& p1, material_id mat)
       : box_min { p0 }
       , box_max { p1 }
-      , material_type { mat_type } {
-    /// Add six sides of the box based on box_min and box_max to sides
-    sides[0] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat_type);
-    sides[1] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat_type);
-    sides[2] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat_type);
-    sides[3] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat_type);
-    sides[4] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat_type);
-    sides[5] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat_type);
+      , material { mat } {}
+
+  /** Distances along the line of a ray where it is inside the box, in one
+      pass
+
+      \return false if the line misses the box
+  */
+  bool interval(const ray& r, real_t& t_enter, real_t& t_exit) const {
+    vec t_near, t_far;
+    slabs(r, t_near, t_far);
+    t_enter = sycl::fmax(t_near.x(), sycl::fmax(t_near.y(), t_near.z()));
+    t_exit = sycl::fmin(t_far.x(), sycl::fmin(t_far.y(), t_far.z()));
+    return t_enter <= t_exit;
   }
 
   /// Compute ray interaction with the box
-  bool hit(auto& ctx, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
-    hit_record temp_rec;
-    material_t temp_material_type;
-    auto hit_anything = false;
-    auto closest_so_far = max;
-    // Checking if the ray hits any of the sides
-    for (const auto& side : sides) {
-      if (dev_visit(
-              [&](auto&& arg) {
-                return arg.hit(ctx, r, min, closest_so_far, temp_rec,
-                               temp_material_type);
-              },
-              side)) {
-        hit_anything = true;
-        closest_so_far = temp_rec.t;
-        rec = temp_rec;
-        hit_material_type = temp_material_type;
-      }
+  bool hit(auto&, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
+    vec t_near, t_far;
+    slabs(r, t_near, t_far);
+    // The ray is in the box after entering the last slab and before leaving
+    // the first one
+    const auto t_enter =
+        sycl::fmax(t_near.x(), sycl::fmax(t_near.y(), t_near.z()));
+    const auto t_exit = sycl::fmin(t_far.x(), sycl::fmin(t_far.y(), t_far.z()));
+    if (!(t_enter <= t_exit))
+      return false;
+    // From inside the box, the ray hits the face where it leaves
+    const bool leaving = t_enter < min;
+    const auto t = leaving ? t_exit : t_enter;
+    if (t < min || t > max)
+      return false;
+    // The axis of the slab giving t
+    const auto slabs = leaving ? t_far : t_near;
+    const int axis = t == slabs.x() ? 0 : t == slabs.y() ? 1 : 2;
+    rec.t = t;
+    rec.p = r.at(t);
+    // The texture coordinates of the face are those of the rectangles: (y, z)
+    // on the x faces, (x, z) on the y faces and (x, y) on the z faces
+    const auto size = box_max - box_min;
+    const auto offset = rec.p - box_min;
+    rec.du = 1 / (axis == 0 ? size.y() : size.x());
+    rec.dv = 1 / (axis == 2 ? size.y() : size.z());
+    rec.u = (axis == 0 ? offset.y() : offset.x()) * rec.du;
+    rec.v = (axis == 2 ? offset.y() : offset.z()) * rec.dv;
+    // The ray enters by the min face of an axis it goes up along
+    const auto dir = r.direction();
+    const auto direction = axis == 0 ? dir.x() : axis == 1 ? dir.y() : dir.z();
+    const real_t side = (direction > 0) == leaving ? 1 : -1;
+    const vec outward_normal { axis == 0 ? side : 0, axis == 1 ? side : 0,
+                               axis == 2 ? side : 0 };
+    rec.set_face_normal(r, outward_normal);
+    rec.material = material;
+    return true;
+  }
+
+  /** Intersect a packet of rays with the box, with the inverse directions
+      of the packet
+
+      \param[out] t is the hit distance of each ray between min and its max,
+      or infinity if it misses
+  */
+  template <std::size_t N>
+  void hit_packet(const ray_packet<N>& r, real_t min,
+                  const typename ray_packet<N>::lanes& max,
+                  typename ray_packet<N>::lanes& t) const {
+    for (std::size_t i = 0; i < N; ++i) {
+      real_t t_enter = -infinity;
+      real_t t_exit = infinity;
+      auto slab = [&](real_t lo, real_t hi, real_t o, real_t inv_d) {
+        const auto t0 = (lo - o) * inv_d;
+        const auto t1 = (hi - o) * inv_d;
+        t_enter = sycl::fmax(t_enter, sycl::fmin(t0, t1));
+        t_exit = sycl::fmin(t_exit, sycl::fmax(t0, t1));
+      };
+      slab(box_min.x(), box_max.x(), r.ox[i], r.inv_dx[i]);
+      slab(box_min.y(), box_max.y(), r.oy[i], r.inv_dy[i]);
+      slab(box_min.z(), box_max.z(), r.oz[i], r.inv_dz[i]);
+      const auto d = t_enter < min ? t_exit : t_enter;
+      t[i] = t_enter <= t_exit && d >= min && d <= max[i] ? d : infinity;
     }
-    return hit_anything;
   }
 
+  aabb bounding_box() const { return { box_min, box_max }; }
+
   point box_min;
   point box_max;
-  material_t material_type;
-  std::array<rectangle_t, 6> sides;
+  material_id material;
+
+ private:
+  /// Distances along a ray to the planes of the box, the nearest and the
+  /// farthest of each axis
+  void slabs(const ray& r, vec& t_near, vec& t_far) const {
+    const auto dir = r.direction();
+    const vec inv_dir { 1 / dir.x(), 1 / dir.y(), 1 / dir.z() };
+    const auto t0 = (box_min - r.origin()) * inv_dir;
+    const auto t1 = (box_max - r.origin()) * inv_dir;
+    t_near = sycl::fmin(t0, t1);
+    t_far = sycl::fmax(t0, t1);
+  }
 };
 
 #endif
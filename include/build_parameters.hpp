@@ -8,6 +8,30 @@ constexpr bool use_single_task = true;
 constexpr bool use_single_task = false;
 #endif
 
+#ifdef USE_TILED_EXECUTOR
+constexpr bool use_tiled_executor = true;
+#else
+constexpr bool use_tiled_executor = false;
+#endif
+
+#ifdef USE_WAVEFRONT_EXECUTOR
+constexpr bool use_wavefront_executor = true;
+#else
+constexpr bool use_wavefront_executor = false;
+#endif
+
+#ifdef USE_SPECIALIZED_KERNELS
+constexpr bool use_specialized_kernels = true;
+#else
+constexpr bool use_specialized_kernels = false;
+#endif
+
+#ifdef USE_INSTRUMENTATION
+constexpr bool use_instrumentation = true;
+#else
+constexpr bool use_instrumentation = false;
+#endif
+
 #ifdef USE_SYCL_COMPILER
 constexpr bool use_sycl_compiler = USE_SYCL_COMPILER;
 #else
@@ -16,6 +40,11 @@ constexpr bool use_sycl_compiler = false;
 
 constexpr int output_width = OUTPUT_WIDTH;
 constexpr int output_height = OUTPUT_HEIGHT;
+constexpr int tile_size = TILE_SIZE;
+constexpr int packet_size = PACKET_SIZE;
+static_assert(packet_size == 0 || packet_size == 4 || packet_size == 8 ||
+                  packet_size == 16,
+              "PACKET_SIZE must be 0, 4, 8 or 16");
 } // namespace buildparams
 
 #endif // BUILD_PARAMETERS_HPP
@@ -0,0 +1,306 @@
+#ifndef RT_SYCL_BVH_HPP
+#define RT_SYCL_BVH_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "ray_packet.hpp"
+#include "rtweekend.hpp"
+#include "vec.hpp"
+
+/** A node of a flattened bounding volume hierarchy
+
+    The nodes are stored in depth-first order in a single array so that the
+    tree can be uploaded as is in a sycl::buffer: the first child of an inner
+    node immediately follows it and only the index of the second child is
+    stored. Leaves reference a contiguous range of primitives.
+*/
+struct bvh_node {
+  /// Value of axis marking a leaf
+  static constexpr std::uint32_t leaf = 3;
+
+  bool is_leaf() const { return axis == leaf; }
+
+  aabb bounds;
+  /// Index of the second child of an inner node, or of the first primitive of
+  /// a leaf
+  std::uint32_t offset;
+  /// Number of primitives of a leaf
+  std::uint32_t count;
+  /// Split axis of an inner node, used to visit the nearest child first
+  std::uint32_t axis;
+};
+
+/** Bounding volume hierarchy built on the host with a binned surface area
+    heuristic
+
+    This implements:
+
+        -
+   https://raytracing.github.io/books/RayTracingTheNextWeek.html#boundingvolumehierarchies
+
+        - Ingo Wald, "On fast Construction of SAH-based Bounding Volume
+   Hierarchies", 2007
+
+    The primitives are not stored here: leaves reference primitives by their
+    position in primitive_indices, so the primitives have to be reordered in
+    the same way before being uploaded to the device.
+*/
+class bvh {
+ public:
+  /// Maximum depth of the tree, which is also the traversal stack size
+  static constexpr int max_depth = 64;
+
+  /// Try to stop splitting when a node has no more primitives than this
+  static constexpr std::uint32_t max_leaf_size = 4;
+
+  /// Number of buckets used to evaluate the surface area heuristic
+  static constexpr int nb_bins = 16;
+
+  bvh() = default;
+
+  /// Build the hierarchy from the bounding box of each primitive
+  explicit bvh(const std::vector<aabb>& boxes)
+      : primitive_boxes { &boxes } {
+    centroids.reserve(boxes.size());
+    primitive_indices.reserve(boxes.size());
+    for (std::uint32_t i = 0; i < boxes.size(); ++i) {
+      centroids.push_back(boxes[i].centroid());
+      primitive_indices.push_back(i);
+    }
+    nodes.reserve(2 * boxes.size() / max_leaf_size + 1);
+    build(0, boxes.size(), 0);
+    centroids.clear();
+    primitive_boxes = nullptr;
+  }
+
+  /// The flattened tree, the root being the first node
+  std::vector<bvh_node> nodes;
+
+  /// The i-th primitive referenced by the leaves is the primitive
+  /// primitive_indices[i] of the input
+  std::vector<std::uint32_t> primitive_indices;
+
+ private:
+  const std::vector<aabb>* primitive_boxes = nullptr;
+  std::vector<point> centroids;
+
+  /// Build the subtree for primitives [begin, end) and return its index
+  std::uint32_t build(std::uint32_t begin, std::uint32_t end, int depth) {
+    auto const& boxes = *primitive_boxes;
+    const std::uint32_t index = nodes.size();
+    nodes.emplace_back();
+
+    aabb bounds, centroid_bounds;
+    for (auto i = begin; i < end; ++i) {
+      bounds.merge(boxes[primitive_indices[i]]);
+      centroid_bounds.merge(centroids[primitive_indices[i]]);
+    }
+
+    auto make_leaf = [&] {
+      nodes[index] = { bounds, begin, end - begin, bvh_node::leaf };
+      return index;
+    };
+
+    const auto count = end - begin;
+    if (count <= max_leaf_size || depth >= max_depth - 1)
+      return make_leaf();
+
+    // Split along the axis where the centroids are the most spread
+    auto extent = centroid_bounds.maximum - centroid_bounds.minimum;
+    int axis = 0;
+    if (extent.y() > extent.x())
+      axis = 1;
+    if (extent.z() > (axis == 0 ? extent.x() : extent.y()))
+      axis = 2;
+    const auto axis_min = centroid_bounds.minimum[axis];
+    const auto axis_extent = extent[axis];
+    // All the centroids are at the same place, no split can help
+    if (!(axis_extent > 0))
+      return make_leaf();
+
+    auto bin_of = [&](std::uint32_t primitive) {
+      auto b = static_cast<int>(nb_bins * (centroids[primitive][axis] -
+                                           axis_min) / axis_extent);
+      return std::clamp(b, 0, nb_bins - 1);
+    };
+
+    std::array<aabb, nb_bins> bin_bounds;
+    std::array<std::uint32_t, nb_bins> bin_count {};
+    for (auto i = begin; i < end; ++i) {
+      auto b = bin_of(primitive_indices[i]);
+      bin_bounds[b].merge(boxes[primitive_indices[i]]);
+      ++bin_count[b];
+    }
+
+    // Sweep from the right to get the cost of each right part, then from the
+    // left to evaluate each split
+    std::array<real_t, nb_bins> right_cost {};
+    aabb right_bounds;
+    std::uint32_t right_count = 0;
+    for (int b = nb_bins - 1; b > 0; --b) {
+      right_bounds.merge(bin_bounds[b]);
+      right_count += bin_count[b];
+      right_cost[b] = right_bounds.surface_area() * right_count;
+    }
+    aabb left_bounds;
+    std::uint32_t left_count = 0;
+    int best_split = 1;
+    auto best_cost = infinity;
+    for (int b = 1; b < nb_bins; ++b) {
+      left_bounds.merge(bin_bounds[b - 1]);
+      left_count += bin_count[b - 1];
+      auto cost = left_bounds.surface_area() * left_count + right_cost[b];
+      if (left_count != 0 && left_count != count && cost < best_cost) {
+        best_cost = cost;
+        best_split = b;
+      }
+    }
+
+    auto middle = std::partition(
+        primitive_indices.begin() + begin, primitive_indices.begin() + end,
+        [&](auto primitive) { return bin_of(primitive) < best_split; });
+    const std::uint32_t split = middle - primitive_indices.begin();
+    if (split == begin || split == end)
+      return make_leaf();
+
+    build(begin, split, depth + 1);
+    auto second = build(split, end, depth + 1);
+    nodes[index] = { bounds, second, 0, static_cast<std::uint32_t>(axis) };
+    return index;
+  }
+};
+
+/** Recompute the bounds of the nodes of a BVH from new bounds of its
+    primitives, keeping the tree
+
+    This is much cheaper than building the BVH again when the primitives only
+    move a little, such as from a frame of an animation to the next one, at
+    the cost of looser nodes as they move further. The children of a node
+    come after it in the array, so a single backward pass updates the
+    children before their parent.
+
+    \param[in,out] nodes is the node array, as a std::vector or a sycl
+    accessor
+
+    \param[in] bounds(i) gives the new box of the i-th primitive referenced
+    by the leaves
+*/
+template <typename Nodes, typename Bounds>
+inline void bvh_refit(Nodes& nodes, std::size_t nb_nodes, Bounds&& bounds) {
+  for (auto i = nb_nodes; i-- > 0;) {
+    // Cannot use a reference on the element with all the accessor types
+    bvh_node node = nodes[i];
+    aabb box;
+    if (node.is_leaf())
+      for (auto p = node.offset; p < node.offset + node.count; ++p)
+        box.merge(bounds(p));
+    else
+      box = surrounding_box(nodes[i + 1].bounds, nodes[node.offset].bounds);
+    node.bounds = box;
+    nodes[i] = node;
+  }
+}
+
+/** Visit the primitives of the leaves of a BVH that a ray goes through
+
+    The traversal uses a fixed-size stack and visits the nearest child first so
+    that the closest hit is found early.
+
+    \param[in] nodes is the node array, as a std::vector or a sycl accessor
+
+    \param[in] max is the current closest hit distance. It is taken by
+    reference so that hit_primitive can shrink it to prune the traversal
+
+    \param[in] hit_primitive is called with the index of each primitive of the
+    leaves the ray goes through. If it returns a bool, true stops the
+    traversal
+*/
+template <typename Nodes, typename Func>
+inline void bvh_traverse(const Nodes& nodes, const ray& r, real_t min,
+                         const real_t& max, Func&& hit_primitive) {
+  const auto origin = r.origin();
+  const auto dir = r.direction();
+  const vec inv_dir { 1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z() };
+  const std::array<bool, 3> dir_is_neg { dir.x() < 0, dir.y() < 0,
+                                         dir.z() < 0 };
+
+  std::uint32_t stack[bvh::max_depth];
+  int stack_size = 0;
+  std::uint32_t current = 0;
+  for (;;) {
+    const auto& node = nodes[current];
+    if (node.bounds.hit(origin, inv_dir, min, max)) {
+      if (!node.is_leaf()) {
+        // Go down the nearest child and keep the other one for later
+        if (dir_is_neg[node.axis]) {
+          stack[stack_size++] = current + 1;
+          current = node.offset;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+        }
+        continue;
+      }
+      for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i)
+        if constexpr (std::is_same_v<decltype(hit_primitive(i)), bool>) {
+          // The visitor can stop the traversal, such as for any-hit queries
+          if (hit_primitive(i))
+            return;
+        } else
+          hit_primitive(i);
+    }
+    if (stack_size == 0)
+      return;
+    current = stack[--stack_size];
+  }
+}
+
+/** Visit the primitives of the leaves of a BVH that at least one ray of a
+    packet goes through
+
+    This is bvh_traverse for a packet of coherent rays: a node is visited
+    once for the whole packet, the nearest child being chosen from the
+    direction of the first ray.
+
+    \param[in] max is the current closest hit distance of each ray
+*/
+template <typename Nodes, std::size_t N, typename Func>
+inline void bvh_traverse_packet(const Nodes& nodes, const ray_packet<N>& rays,
+                                real_t min, const typename ray_packet<N>::lanes& max,
+                                Func&& hit_primitive) {
+  const std::array<bool, 3> dir_is_neg { rays.dx[0] < 0, rays.dy[0] < 0,
+                                         rays.dz[0] < 0 };
+
+  std::uint32_t stack[bvh::max_depth];
+  int stack_size = 0;
+  std::uint32_t current = 0;
+  for (;;) {
+    const auto& node = nodes[current];
+    if (node.bounds.hit_any(rays, min, max)) {
+      if (!node.is_leaf()) {
+        if (dir_is_neg[node.axis]) {
+          stack[stack_size++] = current + 1;
+          current = node.offset;
+        } else {
+          stack[stack_size++] = node.offset;
+          current = current + 1;
+        }
+        continue;
+      }
+      for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i)
+        hit_primitive(i);
+    }
+    if (stack_size == 0)
+      return;
+    current = stack[--stack_size];
+  }
+}
+
+#endif
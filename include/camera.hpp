@@ -42,6 +42,9 @@ class camera {
   /// Size of the lens simulating the depth-of-field
   real_t lens_radius;
 
+  /// Height of the viewport at a distance of 1
+  real_t viewport_height;
+
   /// Shutter open and close times
   real_t time0, time1;
 
@@ -70,7 +73,7 @@ class camera {
       : origin { look_from } {
     auto theta = degrees_to_radians(degree_vfov);
     auto h = sycl::tan(theta / 2);
-    auto viewport_height = 2.0f * h;
+    viewport_height = 2.0f * h;
     auto viewport_width = aspect_ratio * viewport_height;
 
     w = unit_vector(look_from - look_at);
@@ -86,6 +89,12 @@ class camera {
     time1 = _time1;
   }
 
+  /// Angle covered by a pixel for an image of this height, which is the
+  /// spread of the cone of its rays
+  real_t pixel_spread(int image_height) const {
+    return viewport_height / image_height;
+  }
+
   /** Computes ray from camera passing through
           viewport local coordinates (s,t) based on viewport
           width, height and focus distance
@@ -1,12 +1,15 @@
 #ifndef CONSTANT_MEDIUM_HPP
 #define CONSTANT_MEDIUM_HPP
 
+#include "aabb.hpp"
 #include "box.hpp"
 #include "material.hpp"
 #include "sphere.hpp"
 #include "texture.hpp"
 #include "visit.hpp"
 
+/// The shapes bounding a medium, which give the interval of a ray inside
+/// them
 using hittableVolume_t = std::variant<sphere, box>;
 
 /**
@@ -15,53 +18,37 @@ using hittableVolume_t = std::variant<sphere, box>;
  */
 class constant_medium {
  public:
-  constant_medium(const hittableVolume_t& b, real_t d, texture_t& a)
-      : boundary { b }
-      , neg_inv_density { -1 / d }
-      , phase_function { isotropic_material { a } } {}
+  constant_medium() = default;
 
-  constant_medium(const hittableVolume_t& b, real_t d, const color& a)
+  /// The phase function is usually an isotropic_material
+  constant_medium(const hittableVolume_t& b, real_t d, material_id phase)
       : boundary { b }
       , neg_inv_density { -1 / d }
-      , phase_function { isotropic_material { a } } {}
+      , phase_function { phase } {}
 
-  bool hit(auto& ctx, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
+  bool hit(auto& ctx, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
     auto& rng = ctx.rng;
-    hit_material_type = phase_function;
-    material_t temp_material_type;
-    hit_record rec1, rec2;
+    // Where the ray is inside the boundary
+    real_t t_enter, t_exit;
     if (!dev_visit(
-            [&](auto&& arg) {
-              return arg.hit(ctx, r, -infinity, infinity, rec1,
-                             temp_material_type);
-            },
-            boundary)) {
+            [&](auto&& arg) { return arg.interval(r, t_enter, t_exit); },
+            boundary))
       return false;
-    }
 
-    if (!dev_visit(
-            [&](auto&& arg) {
-              return arg.hit(ctx, r, rec1.t + 0.0001f, infinity, rec2,
-                             temp_material_type);
-            },
-            boundary)) {
+    if (t_enter < min)
+      t_enter = min;
+    if (t_exit > max)
+      t_exit = max;
+    if (t_enter >= t_exit)
       return false;
-    }
-
-    if (rec1.t < min)
-      rec1.t = min;
-    if (rec2.t > max)
-      rec2.t = max;
-    if (rec1.t >= rec2.t)
-      return false;
-    if (rec1.t < 0)
-      rec1.t = 0;
+    if (t_enter < 0)
+      t_enter = 0;
 
     const auto ray_length = sycl::length(r.direction());
     /// Distance between the two hitpoints affect of probability
     /// of the ray hitting a smoke particle
-    const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+    const auto distance_inside_boundary = (t_exit - t_enter) * ray_length;
     const auto hit_distance = neg_inv_density * sycl::log(rng.float_t());
 
     /// With lower density, hit_distance has higher probabilty
@@ -69,16 +56,22 @@ class constant_medium {
     if (hit_distance > distance_inside_boundary)
       return false;
 
-    rec.t = rec1.t + hit_distance / ray_length;
+    rec.t = t_enter + hit_distance / ray_length;
     rec.p = r.at(rec.t);
 
     rec.normal = vec { 1, 0, 0 }; // arbitrary
     rec.front_face = true;        // also arbitrary
+    rec.material = phase_function;
     return true;
   }
 
+  /// The medium is contained in its boundary
+  aabb bounding_box() const {
+    return dev_visit([](auto&& arg) { return arg.bounding_box(); }, boundary);
+  }
+
   hittableVolume_t boundary;
   real_t neg_inv_density;
-  material_t phase_function;
+  material_id phase_function;
 };
 #endif
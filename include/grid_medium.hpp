@@ -0,0 +1,351 @@
+#ifndef RT_SYCL_GRID_MEDIUM_HPP
+#define RT_SYCL_GRID_MEDIUM_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "aabb.hpp"
+#include "hitable.hpp"
+#include "instrumentation.hpp"
+#include "ray.hpp"
+#include "rtweekend.hpp"
+#include "texture.hpp"
+#include "vec.hpp"
+
+/** A medium whose density varies in an axis aligned box, given by a grid of
+    voxels
+
+    The voxels are bytes, 255 being the maximum density given to the
+    constructor, interpolated trilinearly between their centers. They are
+    stored with the texels in the texture data, with a coarse grid of
+    majorants: each cell of cell_size voxels on a side keeps the largest
+    density its points can have.
+
+    A ray is followed cell by cell through the majorant grid, skipping the
+    empty cells, and the collisions are sampled with delta tracking against
+    the majorant of each cell: tentative collisions are taken at exponential
+    optical depths of the majorant, the depth left at the end of a cell
+    being carried to the next one, and accepted with the probability
+    density / majorant. Tight majorants make few rejected
+    collisions, each costing a density lookup, compared to a single majorant
+    for the whole grid.
+
+    Shadow rays do not stop in the medium but are attenuated by its
+    transmittance, estimated by ratio tracking along the same cells.
+
+    The random numbers of the tracking come from their own hashed stream,
+    see tracking_rng.
+*/
+class grid_medium {
+ public:
+  /// Voxels on a side of a cell of the majorant grid
+  static constexpr std::uint32_t cell_size = 8;
+
+  grid_medium() = default;
+
+  /** Store a grid of voxels in the texture data
+
+      \param[in] voxels are the nx * ny * nz densities, x varying fastest
+      then y
+
+      \param[in] density is the density of a voxel of value 255
+
+      \param[in] phase is the material scattering in the medium, usually an
+      isotropic_material
+  */
+  grid_medium(const aabb& bounds, real_t density, std::uint32_t nx,
+              std::uint32_t ny, std::uint32_t nz,
+              const std::vector<std::uint8_t>& voxels, texture_table& data,
+              material_id phase)
+      : bounds { bounds }
+      , size { nx, ny, nz }
+      , cells { (nx + cell_size - 1) / cell_size,
+                (ny + cell_size - 1) / cell_size,
+                (nz + cell_size - 1) / cell_size }
+      , density_scale { density / 255 }
+      , phase_function { phase } {
+    const auto extent = bounds.maximum - bounds.minimum;
+    to_voxel = vec { static_cast<real_t>(nx), static_cast<real_t>(ny),
+                     static_cast<real_t>(nz) } /
+               extent;
+    to_cell = to_voxel / static_cast<real_t>(cell_size);
+    voxel_offset = data.add_data(voxels);
+    majorant_offset = data.add_data(majorant_grid(voxels));
+  }
+
+  /** Read a raw file of nx * ny * nz bytes, x varying fastest then y
+
+      \return false after printing an error if the file cannot be read or is
+      too short
+  */
+  static bool read_voxels(const char* file_name, std::size_t count,
+                          std::vector<std::uint8_t>& voxels) {
+    std::FILE* file = std::fopen(file_name, "rb");
+    if (!file) {
+      std::cerr << "ERROR: Could not open voxel file '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    voxels.resize(count);
+    const auto read = std::fread(voxels.data(), 1, count, file);
+    std::fclose(file);
+    if (read != count) {
+      std::cerr << "ERROR: Voxel file '" << file_name << "' has " << read
+                << " bytes instead of " << count << '.' << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /// Sample a collision with the medium by delta tracking
+  bool hit(auto& ctx, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
+    tracking_rng rng { ctx.rng };
+    const auto ray_length = sycl::length(r.direction());
+    // Optical depth of the majorant left before the next tentative
+    // collision, carried over the cells
+    auto depth = -sycl::log(1 - rng.float_t());
+    return march(ctx, r, min, max,
+                 [&](real_t t, real_t t_exit, real_t majorant) {
+                   // Majorant per unit of the ray parameter
+                   const auto rate = majorant * ray_length;
+                   for (;;) {
+                     const auto t_collision = t + depth / rate;
+                     if (t_collision >= t_exit) {
+                       depth -= (t_exit - t) * rate;
+                       return false;
+                     }
+                     t = t_collision;
+                     depth = -sycl::log(1 - rng.float_t());
+                     ctx.counters.add(instrumentation::medium_lookups);
+                     if (rng.float_t() * majorant < density(ctx, r.at(t))) {
+                       rec.t = t;
+                       rec.p = r.at(t);
+                       rec.normal = vec { 1, 0, 0 }; // arbitrary
+                       rec.front_face = true;        // also arbitrary
+                       rec.material = phase_function;
+                       return true;
+                     }
+                   }
+                 });
+  }
+
+  /** Fraction of the light going through the medium between min and max,
+      estimated by ratio tracking
+
+      Russian roulette ends the tracking once the transmittance is low,
+      rather than looking up the density up to the end of the medium.
+  */
+  real_t transmittance(auto& ctx, const ray& r, real_t min,
+                       real_t max) const {
+    tracking_rng rng { ctx.rng };
+    const auto ray_length = sycl::length(r.direction());
+    real_t transmitted = 1;
+    auto depth = -sycl::log(1 - rng.float_t());
+    march(ctx, r, min, max, [&](real_t t, real_t t_exit, real_t majorant) {
+      const auto rate = majorant * ray_length;
+      for (;;) {
+        const auto t_collision = t + depth / rate;
+        if (t_collision >= t_exit) {
+          depth -= (t_exit - t) * rate;
+          return false;
+        }
+        t = t_collision;
+        depth = -sycl::log(1 - rng.float_t());
+        ctx.counters.add(instrumentation::medium_lookups);
+        transmitted *= 1 - density(ctx, r.at(t)) / majorant;
+        if (!(transmitted > 0))
+          return true;
+        if (transmitted < 0.1f) {
+          if (rng.float_t() >= 0.5f) {
+            transmitted = 0;
+            return true;
+          }
+          transmitted *= 2;
+        }
+      }
+    });
+    return sycl::fmax(transmitted, 0.f);
+  }
+
+  aabb bounding_box() const { return bounds; }
+
+  aabb bounds;
+  /// Voxels along each axis
+  std::uint32_t size[3];
+  /// Majorant cells along each axis
+  std::uint32_t cells[3];
+  /// Scale from the box to voxel and cell coordinates
+  vec to_voxel;
+  vec to_cell;
+  /// Offsets of the voxels and of the majorant grid in the texture data
+  std::size_t voxel_offset;
+  std::size_t majorant_offset;
+  real_t density_scale;
+  material_id phase_function;
+
+ private:
+  /** Random numbers for the tracking of a ray: a counter hashed with a seed
+      drawn once from the generator of the work-item
+
+      Each tentative collision draws its distance and its acceptance, and
+      with xorshift the correlation of these consecutive draws biases the
+      delta and ratio tracking estimates by a few percent. The hashed draws
+      are independent.
+  */
+  class tracking_rng {
+   public:
+    explicit tracking_rng(auto& rng) {
+      rng.float_t();
+      seed = rng.state();
+    }
+
+    /// A random float in [0, 1)
+    real_t float_t() {
+      // Weyl sequence hashed by lowbias32 from Chris Wellons
+      auto x = seed + 0x9e3779b9u * ++count;
+      x ^= x >> 16;
+      x *= 0x7feb352du;
+      x ^= x >> 15;
+      x *= 0x846ca68bu;
+      x ^= x >> 16;
+      return (x >> 8) * (1.f / (1u << 24));
+    }
+
+   private:
+    std::uint32_t seed;
+    std::uint32_t count = 0;
+  };
+
+  /// Density at a point, interpolated between the voxel centers and
+  /// extended beyond the outer ones
+  real_t density(auto& ctx, const point& p) const {
+    const auto g = (p - bounds.minimum) * to_voxel;
+    const real_t coords[] = { g.x(), g.y(), g.z() };
+    std::uint32_t i0[3], i1[3];
+    real_t w[3];
+    for (int a = 0; a < 3; ++a) {
+      const auto c =
+          sycl::fmin(sycl::fmax(coords[a] - 0.5f, 0.f), size[a] - 1.f);
+      const auto f = sycl::floor(c);
+      i0[a] = static_cast<std::uint32_t>(f);
+      i1[a] = sycl::min(i0[a] + 1, size[a] - 1);
+      w[a] = c - f;
+    }
+    auto voxel = [&](std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+      return static_cast<real_t>(
+          ctx.texture_data[voxel_offset +
+                           (static_cast<std::size_t>(z) * size[1] + y) *
+                               size[0] +
+                           x]);
+    };
+    auto row = [&](std::uint32_t y, std::uint32_t z) {
+      return (1 - w[0]) * voxel(i0[0], y, z) + w[0] * voxel(i1[0], y, z);
+    };
+    auto plane = [&](std::uint32_t z) {
+      return (1 - w[1]) * row(i0[1], z) + w[1] * row(i1[1], z);
+    };
+    return density_scale * ((1 - w[2]) * plane(i0[2]) + w[2] * plane(i1[2]));
+  }
+
+  /** Go through the majorant cells crossed by a ray between min and max, in
+      order, calling f(t_enter, t_exit, majorant) on the non-empty ones
+      until it returns true
+
+      \return true if f stopped the march
+  */
+  bool march(auto& ctx, const ray& r, real_t min, real_t max,
+             auto&& f) const {
+    const auto o = r.origin();
+    const auto d = r.direction();
+    if (!bounds.clip(o, vec { 1 / d.x(), 1 / d.y(), 1 / d.z() }, min, max))
+      return false;
+    // The ray in cell coordinates
+    const auto oc = (o - bounds.minimum) * to_cell;
+    const auto dc = d * to_cell;
+    const real_t origin[] = { oc.x(), oc.y(), oc.z() };
+    const real_t dir[] = { dc.x(), dc.y(), dc.z() };
+    int cell[3], step[3];
+    real_t t_next[3], t_delta[3];
+    for (int a = 0; a < 3; ++a) {
+      const auto entry = origin[a] + min * dir[a];
+      cell[a] = sycl::clamp(static_cast<int>(sycl::floor(entry)), 0,
+                            static_cast<int>(cells[a]) - 1);
+      if (dir[a] > 0) {
+        step[a] = 1;
+        t_next[a] = (cell[a] + 1 - origin[a]) / dir[a];
+        t_delta[a] = 1 / dir[a];
+      } else if (dir[a] < 0) {
+        step[a] = -1;
+        t_next[a] = (cell[a] - origin[a]) / dir[a];
+        t_delta[a] = -1 / dir[a];
+      } else {
+        step[a] = 0;
+        t_next[a] = infinity;
+        t_delta[a] = infinity;
+      }
+    }
+    auto t = min;
+    for (;;) {
+      // The axis of the next cell boundary
+      const int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                             : (t_next[1] < t_next[2] ? 1 : 2);
+      const auto t_exit = sycl::fmin(t_next[axis], max);
+      const auto majorant =
+          density_scale *
+          ctx.texture_data[majorant_offset +
+                           (static_cast<std::size_t>(cell[2]) * cells[1] +
+                            cell[1]) *
+                               cells[0] +
+                           cell[0]];
+      if (majorant > 0 && f(t, t_exit, majorant))
+        return true;
+      if (t_exit >= max)
+        return false;
+      t = t_exit;
+      cell[axis] += step[axis];
+      if (cell[axis] < 0 || cell[axis] >= static_cast<int>(cells[axis]))
+        return false;
+      t_next[axis] += t_delta[axis];
+    }
+  }
+
+  /// The largest voxel used by the interpolation in each cell, which
+  /// includes the voxels around it
+  std::vector<std::uint8_t>
+  majorant_grid(const std::vector<std::uint8_t>& voxels) const {
+    std::vector<std::uint8_t> majorants(static_cast<std::size_t>(cells[0]) *
+                                        cells[1] * cells[2]);
+    // The voxels of a cell along an axis, with 1 voxel more on each side
+    auto range = [&](int a, std::uint32_t c, std::uint32_t& lo,
+                     std::uint32_t& hi) {
+      lo = c ? c * cell_size - 1 : 0;
+      hi = std::min((c + 1) * cell_size + 1, size[a]);
+    };
+    std::size_t m = 0;
+    for (std::uint32_t cz = 0; cz < cells[2]; ++cz)
+      for (std::uint32_t cy = 0; cy < cells[1]; ++cy)
+        for (std::uint32_t cx = 0; cx < cells[0]; ++cx) {
+          std::uint32_t x0, x1, y0, y1, z0, z1;
+          range(0, cx, x0, x1);
+          range(1, cy, y0, y1);
+          range(2, cz, z0, z1);
+          std::uint8_t highest = 0;
+          for (auto z = z0; z < z1; ++z)
+            for (auto y = y0; y < y1; ++y) {
+              const auto* row =
+                  &voxels[(static_cast<std::size_t>(z) * size[1] + y) *
+                          size[0]];
+              highest = std::max(highest, *std::max_element(row + x0, row + x1));
+            }
+          majorants[m++] = highest;
+        }
+    return majorants;
+  }
+};
+
+#endif
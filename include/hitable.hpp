@@ -1,10 +1,15 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include <cstdint>
+
 #include "ray.hpp"
 #include "rtweekend.hpp"
 #include "vec.hpp"
 
+/// Index of a material in the scene material_table
+using material_id = std::uint32_t;
+
 class hit_record {
  public:
   float t;         //
@@ -15,6 +20,14 @@ class hit_record {
   and mercator coordintes for spheres */
   float u;
   float v;
+  // change of u and v per unit of length on the surface, to filter the
+  // textures, 0 when unknown
+  float du = 0;
+  float dv = 0;
+  // width of the footprint of the ray around the hit point, set when shading
+  float footprint = 0;
+  // material of the hit object, resolved once the closest hit is known
+  material_id material;
 
   // To set if the hit point is on the front face
   void set_face_normal(const ray& r, const vec& outward_normal) {
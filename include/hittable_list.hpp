@@ -0,0 +1,61 @@
+#ifndef RT_SYCL_HITTABLE_LIST_HPP
+#define RT_SYCL_HITTABLE_LIST_HPP
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/** The graphical objects of a scene, stored with one tightly packed array per
+    primitive type
+
+    Compared to an array of std::variant, each primitive only takes the size
+    of its own type and the renderer can loop over each type without any
+    dispatch.
+
+    The primitive types are given at compile time, so only the kinds a scene
+    uses are instantiated in the kernels.
+*/
+template <typename... Primitives> class hittable_list {
+ public:
+  /// Add a primitive, which must be one of the types of the list
+  template <typename Primitive> void add(const Primitive& primitive) {
+    get<Primitive>().push_back(primitive);
+  }
+
+  /// The array of the primitives of a given type
+  template <typename Primitive> std::vector<Primitive>& get() {
+    return std::get<std::vector<Primitive>>(primitives);
+  }
+
+  template <typename Primitive> const std::vector<Primitive>& get() const {
+    return std::get<std::vector<Primitive>>(primitives);
+  }
+
+  /// Call f on the array of each primitive type, in the order of the list
+  template <typename Func> void for_each_type(Func&& f) const {
+    std::apply([&](const auto&... arrays) { (f(arrays), ...); }, primitives);
+  }
+
+  /// Total number of primitives
+  std::size_t size() const {
+    std::size_t s = 0;
+    for_each_type([&](const auto& array) { s += array.size(); });
+    return s;
+  }
+
+  /// Number of bytes used by the primitives
+  std::size_t memory_size() const {
+    std::size_t s = 0;
+    for_each_type([&](const auto& array) {
+      s += array.size() * sizeof(typename std::decay_t<decltype(array)>::
+                                     value_type);
+    });
+    return s;
+  }
+
+ private:
+  std::tuple<std::vector<Primitives>...> primitives;
+};
+
+#endif
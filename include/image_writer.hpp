@@ -0,0 +1,372 @@
+#ifndef RT_SYCL_IMAGE_WRITER_HPP
+#define RT_SYCL_IMAGE_WRITER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
+/** Encoding of the rendered images to files
+
+    The images come already converted to 8-bit components by the device, see
+    tonemap.hpp. The PNG compression is spread over the host threads by bands
+    of rows, which matters for large frames where it would otherwise dominate
+    the end of the job. The QOI and binary PPM encoders are much faster than
+    PNG at the price of larger files. The Radiance HDR format keeps the high
+    dynamic range of the image.
+*/
+namespace image_writer {
+
+enum class format { png, qoi, ppm, hdr };
+
+/// Read a format name, returning false if it is unknown
+inline bool parse_format(std::string_view name, format& f) {
+  if (name == "png")
+    f = format::png;
+  else if (name == "qoi")
+    f = format::qoi;
+  else if (name == "ppm")
+    f = format::ppm;
+  else if (name == "hdr")
+    f = format::hdr;
+  else
+    return false;
+  return true;
+}
+
+inline const char* extension(format f) {
+  switch (f) {
+  case format::qoi:
+    return ".qoi";
+  case format::ppm:
+    return ".ppm";
+  case format::hdr:
+    return ".hdr";
+  default:
+    return ".png";
+  }
+}
+
+/// An image of 8-bit RGB or RGBE pixels, the first row being the top one
+struct byte_image {
+  std::size_t width;
+  std::size_t height;
+  /// 3 for RGB, 4 for RGBE
+  std::size_t channels;
+  std::vector<std::uint8_t> pixels;
+
+  const std::uint8_t* row(std::size_t y) const {
+    return pixels.data() + channels * width * y;
+  }
+};
+
+/// Tell whether a format stores RGBE pixels rather than RGB ones
+inline bool is_hdr(format f) { return f == format::hdr; }
+
+/** Call f(band, begin, end) for bands of rows [begin, end) covering
+    [0, nb_rows) in parallel, one band per host thread
+
+    \return the number of bands
+*/
+inline std::size_t for_each_band(std::size_t nb_rows, auto&& f) {
+  const std::size_t nb_threads =
+      std::max(1u, std::thread::hardware_concurrency());
+  // Do not bother spawning threads for a few rows
+  const auto nb_bands =
+      std::clamp<std::size_t>(nb_rows / 16, 1, nb_threads);
+  std::vector<std::thread> threads;
+  for (std::size_t b = 0; b < nb_bands; ++b) {
+    const auto begin = nb_rows * b / nb_bands;
+    const auto end = nb_rows * (b + 1) / nb_bands;
+    if (b + 1 == nb_bands)
+      f(b, begin, end);
+    else
+      threads.emplace_back([=, &f] { f(b, begin, end); });
+  }
+  for (auto& t : threads)
+    t.join();
+  return nb_bands;
+}
+
+inline bool write_file(const char* file_name,
+                       const std::vector<std::uint8_t>& data) {
+  std::ofstream out { file_name, std::ios::binary };
+  out.write(reinterpret_cast<const char*>(data.data()), data.size());
+  if (!out) {
+    std::cerr << "ERROR: Could not write image file '" << file_name << "'."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// Binary PPM: a short text header followed by the raw pixels
+inline std::vector<std::uint8_t> encode_ppm(const byte_image& image) {
+  const auto header = "P6\n" + std::to_string(image.width) + " " +
+                      std::to_string(image.height) + "\n255\n";
+  std::vector<std::uint8_t> data(header.begin(), header.end());
+  data.insert(data.end(), image.pixels.begin(), image.pixels.end());
+  return data;
+}
+
+/// Radiance HDR with flat RGBE scanlines
+inline std::vector<std::uint8_t> encode_hdr(const byte_image& image) {
+  const auto header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " +
+                      std::to_string(image.height) + " +X " +
+                      std::to_string(image.width) + "\n";
+  std::vector<std::uint8_t> data(header.begin(), header.end());
+  data.insert(data.end(), image.pixels.begin(), image.pixels.end());
+  return data;
+}
+
+inline void append_be32(std::vector<std::uint8_t>& data, std::uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    data.push_back(static_cast<std::uint8_t>(v >> shift));
+}
+
+/** The Quite OK Image format, lossless and encoded in a single fast pass
+
+    See https://qoiformat.org/qoi-specification.pdf
+*/
+inline std::vector<std::uint8_t> encode_qoi(const byte_image& image) {
+  constexpr std::uint8_t op_index = 0x00, op_diff = 0x40, op_luma = 0x80,
+                         op_run = 0xc0, op_rgb = 0xfe;
+  std::vector<std::uint8_t> data { 'q', 'o', 'i', 'f' };
+  // Worst case of one op_rgb per pixel
+  data.reserve(14 + image.pixels.size() / 3 * 4 + 8);
+  append_be32(data, image.width);
+  append_be32(data, image.height);
+  // 3 channels, sRGB
+  data.push_back(3);
+  data.push_back(0);
+  // Previously seen pixels, starting with transparent black while all the
+  // pixels of the image have an alpha of 255
+  std::array<std::array<std::uint8_t, 4>, 64> seen {};
+  std::array<std::uint8_t, 4> previous { 0, 0, 0, 255 };
+  int run = 0;
+  const auto* p = image.pixels.data();
+  const auto* end = p + image.pixels.size();
+  for (; p < end; p += 3) {
+    const std::array<std::uint8_t, 4> px { p[0], p[1], p[2], 255 };
+    if (px == previous) {
+      if (++run == 62) {
+        data.push_back(op_run | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+    if (run) {
+      data.push_back(op_run | (run - 1));
+      run = 0;
+    }
+    const auto hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+    if (seen[hash] == px)
+      data.push_back(op_index | hash);
+    else {
+      seen[hash] = px;
+      // Wrapping differences
+      const auto dr = static_cast<std::int8_t>(px[0] - previous[0]);
+      const auto dg = static_cast<std::int8_t>(px[1] - previous[1]);
+      const auto db = static_cast<std::int8_t>(px[2] - previous[2]);
+      const auto dr_dg = static_cast<std::int8_t>(dr - dg);
+      const auto db_dg = static_cast<std::int8_t>(db - dg);
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+        data.push_back(op_diff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+      else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+               db_dg >= -8 && db_dg <= 7) {
+        data.push_back(op_luma | (dg + 32));
+        data.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+      } else
+        data.insert(data.end(), { op_rgb, px[0], px[1], px[2] });
+    }
+    previous = px;
+  }
+  if (run)
+    data.push_back(op_run | (run - 1));
+  data.insert(data.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+  return data;
+}
+
+#ifdef USE_ZLIB
+
+/** Filter a row for PNG compression, choosing the filter type minimizing
+    the sum of the absolute values of the filtered bytes
+
+    \param[in] above is the row above, nullptr for the first row
+
+    \param[out] out receives the filter type followed by the filtered bytes
+*/
+inline void png_filter_row(const std::uint8_t* row, const std::uint8_t* above,
+                           std::size_t size, std::uint8_t* out) {
+  constexpr std::size_t bpp = 3;
+  auto predict = [&](int type, std::size_t i) -> std::uint8_t {
+    const int a = i >= bpp ? row[i - bpp] : 0;
+    const int b = above ? above[i] : 0;
+    const int c = above && i >= bpp ? above[i - bpp] : 0;
+    switch (type) {
+    case 1:
+      return a;
+    case 2:
+      return b;
+    case 3:
+      return (a + b) / 2;
+    case 4: {
+      const int pa = std::abs(b - c), pb = std::abs(a - c),
+                pc = std::abs(a + b - 2 * c);
+      return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+    default:
+      return 0;
+    }
+  };
+  int best_type = 0;
+  std::uint64_t best_cost = UINT64_MAX;
+  for (int type = 0; type < 5; ++type) {
+    std::uint64_t cost = 0;
+    for (std::size_t i = 0; i < size; ++i)
+      cost += std::abs(static_cast<std::int8_t>(row[i] - predict(type, i)));
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_type = type;
+    }
+  }
+  out[0] = best_type;
+  for (std::size_t i = 0; i < size; ++i)
+    out[i + 1] = row[i] - predict(best_type, i);
+}
+
+inline void append_png_chunk(std::vector<std::uint8_t>& png, const char* type,
+                             const std::uint8_t* data, std::size_t size) {
+  append_be32(png, size);
+  const auto start = png.size();
+  png.insert(png.end(), type, type + 4);
+  png.insert(png.end(), data, data + size);
+  append_be32(png, crc32(0, png.data() + start, size + 4));
+}
+
+/** PNG with the rows filtered and compressed in parallel by bands
+
+    Each band is compressed as an independent raw deflate stream ended by a
+    sync flush, so that the streams can simply be concatenated into the
+    single zlib stream of the image, their checksums being combined. This
+    loses the matches across bands, which costs little for bands of many
+    rows.
+*/
+inline std::vector<std::uint8_t> encode_png(const byte_image& image) {
+  const auto row_size = 3 * image.width;
+  std::vector<std::vector<std::uint8_t>> bands(
+      std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<uLong> checksums(bands.size());
+  std::vector<uLong> lengths(bands.size());
+  // Set by each band when compressed, not shared between the threads
+  std::vector<char> compressed(bands.size());
+  const auto nb_bands = for_each_band(image.height, [&](std::size_t b,
+                                                        std::size_t begin,
+                                                        std::size_t end) {
+    std::vector<std::uint8_t> filtered((end - begin) * (row_size + 1));
+    for (auto y = begin; y < end; ++y)
+      png_filter_row(image.row(y), y ? image.row(y - 1) : nullptr, row_size,
+                     filtered.data() + (y - begin) * (row_size + 1));
+    checksums[b] = adler32(adler32(0, nullptr, 0), filtered.data(),
+                           filtered.size());
+    lengths[b] = filtered.size();
+    z_stream stream {};
+    // Negative window bits for a raw deflate stream without zlib wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      return;
+    auto& out = bands[b];
+    out.resize(deflateBound(&stream, filtered.size()) + 16);
+    stream.next_in = filtered.data();
+    stream.avail_in = filtered.size();
+    stream.next_out = out.data();
+    stream.avail_out = out.size();
+    // Only the last band ends the deflate stream
+    const auto flush = end == image.height ? Z_FINISH : Z_SYNC_FLUSH;
+    const auto status = deflate(&stream, flush);
+    // A band whose input is not all consumed or whose output may not be
+    // complete would be truncated in the middle of the stream
+    compressed[b] = status == (flush == Z_FINISH ? Z_STREAM_END : Z_OK) &&
+                    stream.avail_in == 0 && stream.avail_out != 0;
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+  });
+  for (std::size_t b = 0; b < nb_bands; ++b)
+    if (!compressed[b])
+      return {};
+
+  // Default compression level, no preset dictionary
+  std::vector<std::uint8_t> idat { 0x78, 0x9c };
+  auto checksum = checksums[0];
+  for (std::size_t b = 0; b < nb_bands; ++b) {
+    idat.insert(idat.end(), bands[b].begin(), bands[b].end());
+    if (b)
+      checksum = adler32_combine(checksum, checksums[b], lengths[b]);
+  }
+  append_be32(idat, checksum);
+
+  std::vector<std::uint8_t> png { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  std::vector<std::uint8_t> ihdr;
+  append_be32(ihdr, image.width);
+  append_be32(ihdr, image.height);
+  // 8-bit RGB, deflate, adaptive filtering, not interlaced
+  ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 });
+  append_png_chunk(png, "IHDR", ihdr.data(), ihdr.size());
+  append_png_chunk(png, "IDAT", idat.data(), idat.size());
+  append_png_chunk(png, "IEND", nullptr, 0);
+  return png;
+}
+
+#endif
+
+/// Encode an image, RGBE for the HDR formats and RGB otherwise, and write
+/// it to a file
+inline bool write(const char* file_name, const byte_image& image, format f) {
+  if (image.channels != (is_hdr(f) ? 4 : 3)) {
+    std::cerr << "ERROR: Wrong pixel format for image '" << file_name << "'."
+              << std::endl;
+    return false;
+  }
+  switch (f) {
+  case format::hdr:
+    return write_file(file_name, encode_hdr(image));
+  case format::qoi:
+    return write_file(file_name, encode_qoi(image));
+  case format::ppm:
+    return write_file(file_name, encode_ppm(image));
+  default:
+#ifdef USE_ZLIB
+    if (auto png = encode_png(image); !png.empty())
+      return write_file(file_name, png);
+    std::cerr << "ERROR: Could not compress image '" << file_name << "'."
+              << std::endl;
+    return false;
+#else
+    // Single-threaded encoder without zlib
+    if (!stbi_write_png(file_name, image.width, image.height, 3,
+                        image.pixels.data(), image.width * 3)) {
+      std::cerr << "ERROR: Could not write image file '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    return true;
+#endif
+  }
+}
+
+} // namespace image_writer
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef RT_SYCL_INSTRUMENTATION_HPP
+#define RT_SYCL_INSTRUMENTATION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "build_parameters.hpp"
+#include "material.hpp"
+#include "rtweekend.hpp"
+#include "sycl.hpp"
+
+/** Counters of the work done by the renderer, to find the hot spots of a
+    scene
+
+    With buildparams::use_instrumentation, each work-item counts in its
+    render_context and adds its counts to the counters of its pixel when it
+    ends, these per-pixel counters being summed on the host at the end of the
+    render. Without it, the counters are an empty type whose methods do
+    nothing, so the counting code compiles to nothing.
+*/
+namespace instrumentation {
+
+enum counter : std::uint32_t {
+  /// Samples started
+  paths,
+  /// Closest hit queries
+  rays,
+  /// Any-hit queries towards the lights
+  shadow_rays,
+  /// Calls to the hit test of a primitive, for both kinds of rays
+  intersection_tests,
+  /// Density lookups of the tracking through heterogeneous media
+  medium_lookups,
+  /// Paths ending on a material that does not scatter
+  absorbed_paths,
+  /// Paths ended by Russian roulette
+  roulette_paths,
+  /// Paths still bouncing at the maximum depth
+  max_depth_paths,
+  /// First of the calls to scatter, one counter per material type
+  scatters,
+  nb_counters = scatters + std::variant_size_v<material_t>
+};
+
+constexpr const char* counter_names[] = {
+  "paths",          "rays",           "shadow_rays",    "intersection_tests",
+  "medium_lookups", "absorbed_paths", "roulette_paths", "max_depth_paths"
+};
+
+/// Names of the material types, in the order of material_t
+constexpr const char* material_names[] = { "lambertian", "metal", "dielectric",
+                                           "lightsource", "isotropic" };
+static_assert(std::size(material_names) == std::variant_size_v<material_t>);
+
+/// Index of a material type in material_t
+template <typename Material>
+constexpr std::uint32_t material_index = []<std::size_t... I>(
+    std::index_sequence<I...>) {
+  std::uint32_t index = 0;
+  ((std::is_same_v<Material, std::variant_alternative_t<I, material_t>>
+        ? index = I
+        : 0),
+   ...);
+  return index;
+}(std::make_index_sequence<std::variant_size_v<material_t>> {});
+
+/// Counters of a work-item or of a pixel
+struct pixel_counters {
+  void add(std::uint32_t c, std::uint32_t n = 1) { values[c] += n; }
+
+  void add(const pixel_counters& other) {
+    for (std::uint32_t i = 0; i < nb_counters; ++i)
+      values[i] += other.values[i];
+  }
+
+  std::uint32_t values[nb_counters] = {};
+};
+
+/// Counters of the builds without instrumentation
+struct no_counters {
+  void add(std::uint32_t, std::uint32_t = 1) {}
+  void add(const no_counters&) {}
+};
+
+using counters_t = std::conditional_t<buildparams::use_instrumentation,
+                                      pixel_counters, no_counters>;
+
+/// Add the counts c of a work-item, a counters_t, to the counters of a pixel
+inline void add_to_pixel(auto& counters_acc, std::size_t y, std::size_t x,
+                         const auto& c) {
+  if constexpr (buildparams::use_instrumentation) {
+    // Cannot use a reference on the element with all the accessor types
+    pixel_counters p = counters_acc[y][x];
+    p.add(c);
+    counters_acc[y][x] = p;
+  }
+}
+
+/// Sum the counters of all the pixels
+inline std::vector<std::uint64_t>
+total(sycl::buffer<pixel_counters, 2>& counters) {
+  std::vector<std::uint64_t> totals(nb_counters);
+  auto acc = counters.get_access<sycl::access::mode::read>();
+  for (std::size_t y = 0; y < counters.get_range()[0]; ++y)
+    for (std::size_t x = 0; x < counters.get_range()[1]; ++x)
+      for (std::uint32_t i = 0; i < nb_counters; ++i)
+        totals[i] += acc[y][x].values[i];
+  return totals;
+}
+
+/// Write the total counts and a few ratios as a JSON object
+inline void write_json(std::ostream& out,
+                       sycl::buffer<pixel_counters, 2>& counters) {
+  const auto totals = total(counters);
+  out << "{\n";
+  for (std::uint32_t i = 0; i < scatters; ++i)
+    out << "  \"" << counter_names[i] << "\": " << totals[i] << ",\n";
+  out << "  \"scatters\": {";
+  for (std::uint32_t i = 0; i < std::size(material_names); ++i)
+    out << (i ? ", " : " ") << '"' << material_names[i]
+        << "\": " << totals[scatters + i];
+  auto ratio = [&](counter a, counter b) {
+    return totals[b] ? static_cast<double>(totals[a]) / totals[b] : 0.;
+  };
+  out << " },\n"
+      << "  \"rays_per_path\": " << ratio(rays, paths) << ",\n"
+      << "  \"shadow_rays_per_path\": " << ratio(shadow_rays, paths) << ",\n"
+      << "  \"intersection_tests_per_ray\": "
+      << static_cast<double>(totals[intersection_tests]) /
+             std::max<std::uint64_t>(totals[rays] + totals[shadow_rays], 1)
+      << "\n}\n";
+}
+
+/** Map a counter of each pixel to a heat color, black for 0 to white for
+    the maximum of the image through red and yellow
+
+    \return the RGB bytes of the image, first row at the top
+*/
+inline std::vector<std::uint8_t>
+cost_image(sycl::buffer<pixel_counters, 2>& counters, counter c) {
+  const auto height = counters.get_range()[0];
+  const auto width = counters.get_range()[1];
+  auto acc = counters.get_access<sycl::access::mode::read>();
+  std::uint32_t max_value = 1;
+  for (std::size_t y = 0; y < height; ++y)
+    for (std::size_t x = 0; x < width; ++x)
+      max_value = std::max(max_value, acc[y][x].values[c]);
+  std::vector<std::uint8_t> pixels;
+  pixels.reserve(width * height * 3);
+  // The image rows go downwards, so flip the y axis
+  for (auto y = height; y-- > 0;)
+    for (std::size_t x = 0; x < width; ++x) {
+      const auto heat = 3.f * acc[y][x].values[c] / max_value;
+      for (int channel = 0; channel < 3; ++channel)
+        pixels.push_back(static_cast<std::uint8_t>(
+            255 * std::clamp(heat - channel, 0.f, 1.f)));
+    }
+  return pixels;
+}
+
+} // namespace instrumentation
+
+/// The context of the rendering kernels, with the counters of the work-item
+struct render_context : task_context {
+  [[no_unique_address]] instrumentation::counters_t counters {};
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef RT_SYCL_LIGHT_HPP
+#define RT_SYCL_LIGHT_HPP
+
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "hitable.hpp"
+#include "hittable_list.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "rectangle.hpp"
+#include "rtweekend.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "vec.hpp"
+#include "visit.hpp"
+
+/** The shapes of emissive primitives that can be sampled directly
+
+    Each shape provides, through the overloads below:
+
+    - sample_light_direction(shape, p, time, rng, pdf) returning a direction
+      from p towards the shape, with its probability density per solid angle;
+
+    - light_direction_pdf(shape, p, time, light_rec) returning the density of
+      the direction from p to the point light_rec of the shape.
+
+    Emissive primitives of the other types are still found by the paths
+    hitting them.
+*/
+using light_t = std::variant<sphere, xy_rect, triangle>;
+
+/// Tell whether a primitive type can be sampled as a light
+template <typename Primitive, typename Variant = light_t>
+constexpr bool is_light_shape = false;
+
+template <typename Primitive, typename... Shapes>
+constexpr bool is_light_shape<Primitive, std::variant<Shapes...>> =
+    (std::is_same_v<Primitive, Shapes> || ...);
+
+/// Build an orthonormal basis around w and return a * u + b * v + c * w
+inline vec from_basis(const vec& w, real_t a, real_t b, real_t c) {
+  const vec helper = sycl::fabs(w.x()) > 0.9f ? vec { 0, 1, 0 } : vec { 1, 0, 0 };
+  const vec v = unit_vector(sycl::cross(w, helper));
+  const vec u = sycl::cross(w, v);
+  return a * u + b * v + c * w;
+}
+
+/** Solid angle of the cone of the directions hitting a sphere of squared
+    radius r2 from a point at squared distance dist2 from its center
+
+    1 - cos_max is computed as sin_max^2 / (1 + cos_max) since cos_max rounds
+    to 1 for far away spheres.
+*/
+inline real_t cone_solid_angle(real_t r2, real_t dist2) {
+  const auto sin2_max = r2 / dist2;
+  return 2 * pi * sin2_max / (1 + sycl::sqrt(1 - sin2_max));
+}
+
+/// Sample a direction in the cone of the directions from p hitting the
+/// sphere, which is much better than sampling its surface for small lights
+inline vec sample_light_direction(const sphere& s, const point& p, real_t time,
+                                  LocalPseudoRNG& rng, real_t& pdf) {
+  const vec d = s.center(time) - p;
+  const auto dist2 = length_squared(d);
+  const auto r2 = s.radius * s.radius;
+  // From inside the light every direction hits it, do not sample it
+  if (dist2 <= r2) {
+    pdf = 0;
+    return d;
+  }
+  const auto solid_angle = cone_solid_angle(r2, dist2);
+  // 1 - cos_theta is uniform in [0, 1 - cos_max]
+  const auto one_minus_cos = rng.float_t() * solid_angle / (2 * pi);
+  const auto cos_theta = 1 - one_minus_cos;
+  const auto sin_theta =
+      sycl::sqrt(sycl::fmax(0.f, one_minus_cos * (2 - one_minus_cos)));
+  const auto phi = rng.float_t(0, 2 * pi);
+  pdf = 1 / solid_angle;
+  return from_basis(d / sycl::sqrt(dist2), sin_theta * sycl::cos(phi),
+                    sin_theta * sycl::sin(phi), cos_theta);
+}
+
+inline real_t light_direction_pdf(const sphere& s, const point& p, real_t time,
+                                  const hit_record&) {
+  const auto dist2 = length_squared(s.center(time) - p);
+  const auto r2 = s.radius * s.radius;
+  if (dist2 <= r2)
+    return 0;
+  return 1 / cone_solid_angle(r2, dist2);
+}
+
+/// Density per solid angle of a point sampled uniformly on a flat light
+inline real_t area_to_solid_angle_pdf(real_t area, const point& p,
+                                      const hit_record& light_rec) {
+  const vec d = light_rec.p - p;
+  const auto dist2 = length_squared(d);
+  const auto cosine = sycl::fabs(dot(light_rec.normal, d)) / sycl::sqrt(dist2);
+  return cosine > 0 ? dist2 / (cosine * area) : 0;
+}
+
+inline real_t light_area(const xy_rect& r) {
+  return (r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+inline vec sample_light_direction(const xy_rect& r, const point& p, real_t,
+                                  LocalPseudoRNG& rng, real_t& pdf) {
+  const point q { rng.float_t(r.x0, r.x1), rng.float_t(r.y0, r.y1), r.k };
+  const vec d = q - p;
+  const auto dist2 = length_squared(d);
+  const auto cosine = sycl::fabs(d.z()) / sycl::sqrt(dist2);
+  pdf = cosine > 0 ? dist2 / (cosine * light_area(r)) : 0;
+  return unit_vector(d);
+}
+
+inline real_t light_direction_pdf(const xy_rect& r, const point& p, real_t,
+                                  const hit_record& light_rec) {
+  return area_to_solid_angle_pdf(light_area(r), p, light_rec);
+}
+
+inline real_t light_area(const triangle& t) {
+  return 0.5f * sycl::length(sycl::cross(t.v1 - t.v0, t.v2 - t.v0));
+}
+
+inline vec sample_light_direction(const triangle& t, const point& p, real_t,
+                                  LocalPseudoRNG& rng, real_t& pdf) {
+  // Uniform sampling of the triangle surface
+  const auto su = sycl::sqrt(rng.float_t());
+  const auto b = rng.float_t();
+  const point q = (1 - su) * t.v0 + su * (1 - b) * t.v1 + su * b * t.v2;
+  const vec d = q - p;
+  const auto dist2 = length_squared(d);
+  const vec n = sycl::cross(t.v1 - t.v0, t.v2 - t.v0);
+  const auto cosine = sycl::fabs(dot(n, d)) / sycl::sqrt(dist2 * length_squared(n));
+  pdf = cosine > 0 ? dist2 / (cosine * light_area(t)) : 0;
+  return unit_vector(d);
+}
+
+inline real_t light_direction_pdf(const triangle& t, const point& p, real_t,
+                                  const hit_record& light_rec) {
+  return area_to_solid_angle_pdf(light_area(t), p, light_rec);
+}
+
+/// Device view of the lights of a scene
+template <typename LightAcc> struct light_view {
+  LightAcc lights;
+  /// Number of lights, the accessor being padded when there is none
+  std::uint32_t count;
+};
+
+/** Give each primitive of the light list its own copy of its
+    lightsource_material, recording its index in the list
+
+    A path hitting a light then finds which light of the list it is from the
+    material of the hit, instead of intersecting every light. This must be
+    done before the scene is uploaded, the lights being numbered in the order
+    of make_light_list().
+*/
+template <typename... Primitives>
+void separate_light_materials(hittable_list<Primitives...>& hittables,
+                              material_table& materials) {
+  std::uint32_t index = 0;
+  (
+      [&] {
+        if constexpr (is_light_shape<Primitives>)
+          for (auto& p : hittables.template get<Primitives>())
+            if (const auto* m =
+                    std::get_if<lightsource_material>(&materials[p.material])) {
+              auto light = *m;
+              light.light = index++;
+              p.material = materials.add_unshared(light);
+            }
+      }(),
+      ...);
+}
+
+/// Collect the primitives with a lightsource_material that can be sampled
+template <typename... Primitives>
+std::vector<light_t> make_light_list(
+    const hittable_list<Primitives...>& hittables,
+    const material_table& materials) {
+  std::vector<light_t> lights;
+  hittables.for_each_type([&]<typename Primitive>(
+                              const std::vector<Primitive>& primitives) {
+    if constexpr (is_light_shape<Primitive>)
+      for (const auto& p : primitives)
+        if (std::holds_alternative<lightsource_material>(
+                materials[p.material]))
+          lights.push_back(p);
+  });
+  return lights;
+}
+
+/// Power heuristic weight of a strategy of density pdf against another one
+/// of density other_pdf, for multiple importance sampling
+inline real_t power_heuristic(real_t pdf, real_t other_pdf) {
+  return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+/** Density per solid angle of sampling the direction of a ray from the
+    light list, used to weight the light a path finds by itself
+
+    \param[in] rec is the closest hit of the ray, on a light
+
+    \param[in] light is the index of this light in the list, given by its
+    lightsource_material, or lightsource_material::not_sampled
+*/
+inline real_t light_list_pdf(const auto& lights, const ray& r,
+                             const hit_record& rec, std::uint32_t light) {
+  if (light >= lights.count)
+    return 0;
+  return dev_visit(
+             [&](auto&& shape) {
+               return light_direction_pdf(shape, r.origin(), r.time(), rec);
+             },
+             lights.lights[light]) /
+         lights.count;
+}
+
+#endif
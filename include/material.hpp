@@ -1,7 +1,12 @@
 #ifndef RT_SYCL_MATERIAL_HPP
 #define RT_SYCL_MATERIAL_HPP
 
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include "hitable.hpp"
 #include "texture.hpp"
@@ -26,7 +31,11 @@ struct lambertian_material {
         dev_visit([&](auto&& arg) { return arg.value(ctx, rec); }, albedo);
     return true;
   }
-  color emitted(auto&, const hit_record& rec) { return color(0, 0, 0); }
+  color emitted(auto&, const hit_record& rec) const { return color(0, 0, 0); }
+
+  /// Fields identifying the material, used to share identical materials
+  auto fields() const { return std::tie(albedo); }
+
   texture_t albedo;
 };
 
@@ -47,7 +56,10 @@ struct metal_material {
     return (dot(scattered.direction(), rec.normal) > 0);
   }
 
-  color emitted(auto&, const hit_record& rec) { return color(0, 0, 0); }
+  color emitted(auto&, const hit_record& rec) const { return color(0, 0, 0); }
+
+  auto fields() const { return std::tie(albedo, fuzz); }
+
   color albedo;
   float fuzz;
 };
@@ -87,7 +99,10 @@ struct dielectric_material {
     return true;
   }
 
-  color emitted(auto&, const hit_record& rec) { return color(0, 0, 0); }
+  color emitted(auto&, const hit_record& rec) const { return color(0, 0, 0); }
+
+  auto fields() const { return std::tie(ref_idx, albedo); }
+
   // Refractive index of the glass
   real_t ref_idx;
   // Color of the glass
@@ -103,11 +118,19 @@ struct lightsource_material {
 
   template <typename... T> bool scatter(T&...) const { return false; }
 
-  color emitted(auto& ctx, const hit_record& rec) {
+  color emitted(auto& ctx, const hit_record& rec) const {
     return dev_visit([&](auto&& arg) { return arg.value(ctx, rec); }, emit);
   }
 
+  auto fields() const { return std::tie(emit); }
+
+  /// Value of light for the primitives that are not in the light list
+  static constexpr std::uint32_t not_sampled = 0xffffffff;
+
   texture_t emit;
+  /// Index in the light list of the only primitive using this material, to
+  /// weight the light found by a path, see separate_light_materials()
+  std::uint32_t light = not_sampled;
 };
 
 struct isotropic_material {
@@ -125,7 +148,9 @@ struct isotropic_material {
     return true;
   }
 
-  color emitted(auto&, const hit_record& rec) { return color(0, 0, 0); }
+  color emitted(auto&, const hit_record& rec) const { return color(0, 0, 0); }
+
+  auto fields() const { return std::tie(albedo); }
 
   texture_t albedo;
 };
@@ -134,4 +159,78 @@ using material_t =
     std::variant<lambertian_material, metal_material, dielectric_material,
                  lightsource_material, isotropic_material>;
 
+namespace detail {
+
+/// Append to key a byte representation of the fields() of a material or
+/// texture, so that identical materials get identical keys
+template <typename T>
+requires requires(const T& t) { t.fields(); }
+void append_key(std::string& key, const T& value);
+
+template <typename T>
+requires std::is_arithmetic_v<T> || std::is_enum_v<T>
+void append_key(std::string& key, const T& value) {
+  key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void append_key(std::string& key, const vec& value) {
+  append_key(key, value.x());
+  append_key(key, value.y());
+  append_key(key, value.z());
+}
+
+template <typename... Ts>
+void append_key(std::string& key, const std::variant<Ts...>& value) {
+  append_key(key, value.index());
+  std::visit([&](auto&& arg) { append_key(key, arg); }, value);
+}
+
+template <typename T>
+requires requires(const T& t) { t.fields(); }
+void append_key(std::string& key, const T& value) {
+  std::apply([&](const auto&... field) { (append_key(key, field), ...); },
+             value.fields());
+}
+
+} // namespace detail
+
+/** Scene-level table of materials
+
+    Primitives only store the material_id of their material, which is
+    resolved through this table once the closest hit of a ray is known. The
+    table is uploaded once to the device.
+
+    Adding a material identical to one already in the table returns the index
+    of the existing one.
+*/
+class material_table {
+ public:
+  /// Add a material if not already there and return its index
+  material_id add(const material_t& material) {
+    std::string key;
+    detail::append_key(key, material);
+    auto [it, inserted] = index.try_emplace(std::move(key), materials.size());
+    if (inserted)
+      materials.push_back(material);
+    return it->second;
+  }
+
+  /// Add a material used by a single primitive, never shared with the
+  /// identical ones, and return its index
+  material_id add_unshared(const material_t& material) {
+    materials.push_back(material);
+    return materials.size() - 1;
+  }
+
+  const material_t& operator[](material_id id) const { return materials[id]; }
+
+  std::size_t size() const { return materials.size(); }
+
+  const material_t* data() const { return materials.data(); }
+
+ private:
+  std::vector<material_t> materials;
+  std::unordered_map<std::string, material_id> index;
+};
+
 #endif
@@ -0,0 +1,61 @@
+#ifndef RT_SYCL_RAY_PACKET_HPP
+#define RT_SYCL_RAY_PACKET_HPP
+
+#include <array>
+#include <cstddef>
+
+#include "ray.hpp"
+#include "rtweekend.hpp"
+#include "vec.hpp"
+
+/** A packet of N coherent rays traced together
+
+    The rays are stored in structure of arrays layout so that the loops over
+    the lanes of the packet in the intersection tests compile to SIMD
+    instructions, each lane being one ray.
+
+    Only the first count lanes are valid. The other lanes are copies of the
+    first ray so that the vectorized tests can always process the whole
+    packet, their results being ignored.
+*/
+template <std::size_t N> struct ray_packet {
+  static constexpr std::size_t size = N;
+
+  using lanes = std::array<real_t, N>;
+
+  /// Set the rays of the packet, with 1 <= nb_rays <= N
+  void set(const ray* rays, int nb_rays) {
+    count = nb_rays;
+    for (std::size_t i = 0; i < N; ++i) {
+      const auto& r = rays[i < static_cast<std::size_t>(nb_rays) ? i : 0];
+      ox[i] = r.origin().x();
+      oy[i] = r.origin().y();
+      oz[i] = r.origin().z();
+      dx[i] = r.direction().x();
+      dy[i] = r.direction().y();
+      dz[i] = r.direction().z();
+      inv_dx[i] = 1.0f / dx[i];
+      inv_dy[i] = 1.0f / dy[i];
+      inv_dz[i] = 1.0f / dz[i];
+      time[i] = r.time();
+    }
+  }
+
+  /// The ray of a lane
+  ray get(int i) const {
+    return { point { ox[i], oy[i], oz[i] }, vec { dx[i], dy[i], dz[i] },
+             time[i] };
+  }
+
+  /// Origins of the rays
+  lanes ox, oy, oz;
+  /// Directions of the rays
+  lanes dx, dy, dz;
+  /// Component-wise inverses of the directions, for the box tests
+  lanes inv_dx, inv_dy, inv_dz;
+  lanes time;
+  /// Number of valid lanes
+  int count;
+};
+
+#endif
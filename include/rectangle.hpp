@@ -1,8 +1,10 @@
 #ifndef RECT_HPP
 #define RECT_HPP
 
+#include "aabb.hpp"
 #include "material.hpp"
 #include "ray.hpp"
+#include "ray_packet.hpp"
 #include "rtweekend.hpp"
 #include "texture.hpp"
 #include "vec.hpp"
@@ -19,19 +21,17 @@ class xy_rect {
 
   /// x0 <= x1 and y0 <= y1
   xy_rect(real_t _x0, real_t _x1, real_t _y0, real_t _y1, real_t _k,
-          const material_t& mat_type)
+          material_id mat)
       : x0 { _x0 }
       , x1 { _x1 }
       , y0 { _y0 }
       , y1 { _y1 }
       , k { _k }
-      , material_type { mat_type } {}
+      , material { mat } {}
 
   /// Compute ray interaction with rectangle
-  bool hit(auto&, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
-    hit_material_type = material_type;
-
+  bool hit(auto&, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
     auto t = (k - r.origin().z()) / r.direction().z();
     if (t < min || t > max)
       return false;
@@ -41,14 +41,38 @@ class xy_rect {
       return false;
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (y - y0) / (y1 - y0);
+    rec.du = 1 / (x1 - x0);
+    rec.dv = 1 / (y1 - y0);
     rec.t = t;
     rec.p = r.at(rec.t);
     vec outward_normal = vec(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
+    rec.material = material;
     return true;
   }
+  /// Intersect a packet of rays with the rectangle, setting t to the hit
+  /// distance of each ray between min and its max, or infinity if it misses
+  template <std::size_t N>
+  void hit_packet(const ray_packet<N>& r, real_t min,
+                  const typename ray_packet<N>::lanes& max,
+                  typename ray_packet<N>::lanes& t) const {
+    for (std::size_t i = 0; i < N; ++i) {
+      const auto d = (k - r.oz[i]) / r.dz[i];
+      const auto x = r.ox[i] + d * r.dx[i];
+      const auto y = r.oy[i] + d * r.dy[i];
+      const auto hit = d >= min && d <= max[i] && x >= x0 && x <= x1 &&
+                       y >= y0 && y <= y1;
+      t[i] = hit ? d : infinity;
+    }
+  }
+
+  /// Bounding box of the rectangle, padded in the z direction
+  aabb bounding_box() const {
+    return aabb { point { x0, y0, k }, point { x1, y1, k } }.pad();
+  }
+
   real_t x0, x1, y0, y1, k;
-  material_t material_type;
+  material_id material;
 };
 
 class xz_rect {
@@ -57,19 +81,17 @@ class xz_rect {
 
   /// x0 <= x1 and z0 <= z1
   xz_rect(real_t _x0, real_t _x1, real_t _z0, real_t _z1, real_t _k,
-          const material_t& mat_type)
+          material_id mat)
       : x0 { _x0 }
       , x1 { _x1 }
       , z0 { _z0 }
       , z1 { _z1 }
       , k { _k }
-      , material_type { mat_type } {}
+      , material { mat } {}
 
   /// Compute ray interaction with rectangle
-  bool hit(auto&, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
-    hit_material_type = material_type;
-
+  bool hit(auto&, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
     auto t = (k - r.origin().y()) / r.direction().y();
     if (t < min || t > max)
       return false;
@@ -79,14 +101,38 @@ class xz_rect {
       return false;
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (z - z0) / (z1 - z0);
+    rec.du = 1 / (x1 - x0);
+    rec.dv = 1 / (z1 - z0);
     rec.t = t;
     rec.p = r.at(rec.t);
     vec outward_normal = vec(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
+    rec.material = material;
     return true;
   }
+  /// Intersect a packet of rays with the rectangle, setting t to the hit
+  /// distance of each ray between min and its max, or infinity if it misses
+  template <std::size_t N>
+  void hit_packet(const ray_packet<N>& r, real_t min,
+                  const typename ray_packet<N>::lanes& max,
+                  typename ray_packet<N>::lanes& t) const {
+    for (std::size_t i = 0; i < N; ++i) {
+      const auto d = (k - r.oy[i]) / r.dy[i];
+      const auto x = r.ox[i] + d * r.dx[i];
+      const auto z = r.oz[i] + d * r.dz[i];
+      const auto hit = d >= min && d <= max[i] && x >= x0 && x <= x1 &&
+                       z >= z0 && z <= z1;
+      t[i] = hit ? d : infinity;
+    }
+  }
+
+  /// Bounding box of the rectangle, padded in the y direction
+  aabb bounding_box() const {
+    return aabb { point { x0, k, z0 }, point { x1, k, z1 } }.pad();
+  }
+
   real_t x0, x1, z0, z1, k;
-  material_t material_type;
+  material_id material;
 };
 
 class yz_rect {
@@ -95,19 +141,17 @@ class yz_rect {
 
   /// y0 <= y1 and z0 <= z1
   yz_rect(real_t _y0, real_t _y1, real_t _z0, real_t _z1, real_t _k,
-          const material_t& mat_type)
+          material_id mat)
       : y0 { _y0 }
       , y1 { _y1 }
       , z0 { _z0 }
       , z1 { _z1 }
       , k { _k }
-      , material_type { mat_type } {}
+      , material { mat } {}
 
   /// Compute ray interaction with rectangle
-  bool hit(auto&, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
-    hit_material_type = material_type;
-
+  bool hit(auto&, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
     auto t = (k - r.origin().x()) / r.direction().x();
     if (t < min || t > max)
       return false;
@@ -117,14 +161,38 @@ class yz_rect {
       return false;
     rec.u = (y - y0) / (y1 - y0);
     rec.v = (z - z0) / (z1 - z0);
+    rec.du = 1 / (y1 - y0);
+    rec.dv = 1 / (z1 - z0);
     rec.t = t;
     rec.p = r.at(rec.t);
     vec outward_normal = vec(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
+    rec.material = material;
     return true;
   }
+  /// Intersect a packet of rays with the rectangle, setting t to the hit
+  /// distance of each ray between min and its max, or infinity if it misses
+  template <std::size_t N>
+  void hit_packet(const ray_packet<N>& r, real_t min,
+                  const typename ray_packet<N>::lanes& max,
+                  typename ray_packet<N>::lanes& t) const {
+    for (std::size_t i = 0; i < N; ++i) {
+      const auto d = (k - r.ox[i]) / r.dx[i];
+      const auto y = r.oy[i] + d * r.dy[i];
+      const auto z = r.oz[i] + d * r.dz[i];
+      const auto hit = d >= min && d <= max[i] && y >= y0 && y <= y1 &&
+                       z >= z0 && z <= z1;
+      t[i] = hit ? d : infinity;
+    }
+  }
+
+  /// Bounding box of the rectangle, padded in the x direction
+  aabb bounding_box() const {
+    return aabb { point { k, y0, z0 }, point { k, y1, z1 } }.pad();
+  }
+
   real_t y0, y1, z0, z1, k;
-  material_t material_type;
+  material_id material;
 };
 
 using rectangle_t = std::variant<xy_rect, xz_rect, yz_rect>;
@@ -1,160 +1,916 @@
+#ifndef RT_SYCL_RENDER_HPP
+#define RT_SYCL_RENDER_HPP
+
 #include <array>
+#include <iostream>
+#include <span>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#include "aabb.hpp"
+#include "accumulation_buffer.hpp"
 #include "box.hpp"
 #include "build_parameters.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
 #include "constant_medium.hpp"
+#include "grid_medium.hpp"
 #include "hitable.hpp"
+#include "hittable_list.hpp"
+#include "instrumentation.hpp"
+#include "light.hpp"
 #include "material.hpp"
 #include "ray.hpp"
+#include "ray_packet.hpp"
 #include "rectangle.hpp"
+#include "render_parameters.hpp"
 #include "rtweekend.hpp"
 #include "sphere.hpp"
 #include "sycl.hpp"
 #include "texture.hpp"
+#include "tile_scheduler.hpp"
 #include "triangle.hpp"
 #include "vec.hpp"
 #include "visit.hpp"
 
-using hittable_t =
-    std::variant<sphere, xy_rect, triangle, box, constant_medium>;
+/// The kinds of graphical objects a scene can use
+using scene_hittables = hittable_list<sphere, xy_rect, xz_rect, yz_rect,
+                                     triangle, box, constant_medium,
+                                     grid_medium>;
 
-template <int width, int height, int samples, int depth>
-inline auto render_pixel(auto& ctx, int x_coord, int y_coord, camera const& cam,
-                         auto& hittable_acc, auto fb_acc) {
-  auto& rng = ctx.rng;
-  auto get_color = [&](const ray& r) {
-    auto hit_world = [&](const ray& r, hit_record& rec,
-                         material_t& material_type) {
-      hit_record temp_rec;
-      material_t temp_material_type;
-      auto hit_anything = false;
-      auto closest_so_far = infinity;
-      // Checking if the ray hits any of the spheres
-      for (auto i = 0; i < hittable_acc.get_count(); i++) {
-        if (dev_visit(
-                [&](auto&& arg) {
-                  return arg.hit(ctx, r, 0.001f, closest_so_far, temp_rec,
-                                 temp_material_type);
-                },
-                hittable_acc[i])) {
-          hit_anything = true;
-          closest_so_far = temp_rec.t;
-          rec = temp_rec;
-          material_type = temp_material_type;
-        }
+/// Name of a primitive type, for reports
+template <typename Primitive> constexpr const char* primitive_name = "?";
+template <> constexpr const char* primitive_name<sphere> = "sphere";
+template <> constexpr const char* primitive_name<xy_rect> = "xy_rect";
+template <> constexpr const char* primitive_name<xz_rect> = "xz_rect";
+template <> constexpr const char* primitive_name<yz_rect> = "yz_rect";
+template <> constexpr const char* primitive_name<triangle> = "triangle";
+template <> constexpr const char* primitive_name<box> = "box";
+template <>
+constexpr const char* primitive_name<constant_medium> = "constant_medium";
+template <> constexpr const char* primitive_name<grid_medium> = "grid_medium";
+
+/// Device view of the primitives of one type and of their BVH
+template <typename PrimitiveAcc, typename NodeAcc> struct primitive_view {
+  PrimitiveAcc primitives;
+  NodeAcc nodes;
+};
+
+/// Find the closest hit of a ray among all the primitive types of the scene
+inline bool hit_world(auto& ctx, auto& hittables_acc, const ray& r,
+                      hit_record& rec) {
+  hit_record temp_rec;
+  auto hit_anything = false;
+  auto closest_so_far = infinity;
+  ctx.counters.add(instrumentation::rays);
+  // Traverse the BVH of each primitive type in turn, the closest hit found
+  // so far pruning the following traversals
+  auto hit_primitives = [&](auto& view) {
+    bvh_traverse(view.nodes, r, 0.001f, closest_so_far, [&](auto i) {
+      ctx.counters.add(instrumentation::intersection_tests);
+      if (view.primitives[i].hit(ctx, r, 0.001f, closest_so_far, temp_rec)) {
+        hit_anything = true;
+        closest_so_far = temp_rec.t;
+        rec = temp_rec;
       }
-      return hit_anything;
-    };
+    });
+  };
+  std::apply([&](auto&... views) { (hit_primitives(views), ...); },
+             hittables_acc);
+  return hit_anything;
+}
+
+/** Fraction of the light going along a ray between its origin and max
+
+    Opaque primitives block it and stop the traversal at the first one
+    found, while the primitives with a transmittance member, such as
+    grid_medium, attenuate it.
+*/
+inline real_t visibility(auto& ctx, auto& hittables_acc, const ray& r,
+                         real_t max) {
+  hit_record rec;
+  real_t visible = 1;
+  ctx.counters.add(instrumentation::shadow_rays);
+  auto hit_primitives = [&](auto& view) {
+    if (!(visible > 0))
+      return;
+    bvh_traverse(view.nodes, r, 0.001f, max, [&](auto i) {
+      ctx.counters.add(instrumentation::intersection_tests);
+      const auto& primitive = view.primitives[i];
+      if constexpr (requires {
+                      primitive.transmittance(ctx, r, 0.001f, max);
+                    })
+        visible *= primitive.transmittance(ctx, r, 0.001f, max);
+      else if (primitive.hit(ctx, r, 0.001f, max, rec))
+        visible = 0;
+      return !(visible > 0);
+    });
+  };
+  std::apply([&](auto&... views) { (hit_primitives(views), ...); },
+             hittables_acc);
+  return visible;
+}
+
+/// Closest hit of a ray computed ahead of its path, such as by a packet
+struct traced_hit {
+  bool hit;
+  hit_record rec;
+};
+
+/** Find the closest hit of each ray of a packet among all the primitive
+    types of the scene
+
+    The primitive types with a hit_packet member are tested for all the rays
+    at once, the others ray by ray. The full hit record is only computed,
+    with the hit member, for the rays whose closest hit changes.
+*/
+template <std::size_t N>
+inline void hit_world_packet(auto& ctx, auto& hittables_acc,
+                             const ray_packet<N>& rays,
+                             std::array<traced_hit, N>& hits) {
+  typename ray_packet<N>::lanes closest_so_far;
+  closest_so_far.fill(infinity);
+  for (auto& h : hits)
+    h.hit = false;
+  hit_record temp_rec;
+  ctx.counters.add(instrumentation::rays, rays.count);
+  auto hit_primitives = [&](auto& view) {
+    bvh_traverse_packet(view.nodes, rays, 0.001f, closest_so_far, [&](auto p) {
+      const auto& primitive = view.primitives[p];
+      ctx.counters.add(instrumentation::intersection_tests, rays.count);
+      auto hit_ray = [&](int i) {
+        if (primitive.hit(ctx, rays.get(i), 0.001f, closest_so_far[i],
+                          temp_rec)) {
+          hits[i] = { true, temp_rec };
+          closest_so_far[i] = temp_rec.t;
+        }
+      };
+      if constexpr (requires(typename ray_packet<N>::lanes& t) {
+                      primitive.hit_packet(rays, 0.001f, closest_so_far, t);
+                    }) {
+        typename ray_packet<N>::lanes t;
+        primitive.hit_packet(rays, 0.001f, closest_so_far, t);
+        for (int i = 0; i < rays.count; ++i)
+          if (t[i] < closest_so_far[i])
+            hit_ray(i);
+      } else
+        for (int i = 0; i < rays.count; ++i)
+          hit_ray(i);
+    });
+  };
+  std::apply([&](auto&... views) { (hit_primitives(views), ...); },
+             hittables_acc);
+}
+
+/**
+   Color of a ray that does not hit anything: linearly blend white and blue
+   color depending on the height of the y coordinate after scaling the ray
+   direction to unit length. While -1.0f < y < 1.0f, hit_pt is between 0 and
+   1. This produces a blue to white gradient in the background
+*/
+inline color background(const ray& r) {
+  vec unit_direction = unit_vector(r.direction());
+  auto hit_pt = 0.5f * (unit_direction.y() + 1.0f);
+  return (1.0f - hit_pt) * color { 1.0f, 1.0f, 1.0f } +
+         hit_pt * color { 0.5f, 0.7f, 1.0f };
+}
+
+/// Light carried by a path so far and what is needed to continue it
+struct path_state {
+  /// Light reaching the camera through the path so far
+  color radiance { 0.0f, 0.0f, 0.0f };
+  /// Product of the attenuations of the bounces so far
+  color throughput { 1.0f, 1.0f, 1.0f };
+  /// Density of the direction of the last bounce when the lights were also
+  /// sampled there, 0 otherwise
+  real_t bsdf_pdf = 0;
+  /** The cone of the rays of the pixel, growing along the path, whose width
+      at a hit point selects the texture level of detail
+
+      This is a ray cone without the curvature of the surfaces: the spread is
+      the angle of a pixel and the width grows with the distance travelled.
+  */
+  real_t cone_width = 0;
+  real_t cone_spread = 0;
+};
+
+/** Light received from the lights at a diffuse hit point through a direction
+    sampled on the light list, weighted for multiple importance sampling with
+    the cosine-weighted direction of the lambertian bounce
+
+    The result is to be multiplied by the albedo and the path throughput.
+*/
+inline color sample_direct_light(auto& ctx, auto& hittables_acc,
+                                 auto& material_acc, const auto& lights,
+                                 const ray& r_in, const hit_record& rec) {
+  auto& rng = ctx.rng;
+  const auto index = sycl::min(
+      static_cast<std::uint32_t>(rng.float_t() * lights.count),
+      lights.count - 1);
+  return dev_visit(
+      [&](auto&& shape) {
+        real_t pdf;
+        const auto direction =
+            sample_light_direction(shape, rec.p, r_in.time(), rng, pdf);
+        const auto cosine = dot(rec.normal, direction);
+        if (!(pdf > 0) || !(cosine > 0))
+          return color { 0.0f, 0.0f, 0.0f };
+        const ray shadow { rec.p, direction, r_in.time() };
+        hit_record light_rec;
+        if (!shape.hit(ctx, shadow, 0.001f, infinity, light_rec))
+          return color { 0.0f, 0.0f, 0.0f };
+        const auto visible =
+            visibility(ctx, hittables_acc, shadow, light_rec.t * 0.999f);
+        if (!(visible > 0))
+          return color { 0.0f, 0.0f, 0.0f };
+        const color emitted = dev_visit(
+            [&](auto&& m) { return m.emitted(ctx, light_rec); },
+            material_acc[light_rec.material]);
+        pdf /= lights.count;
+        const auto bsdf_pdf = cosine / pi;
+        return emitted *
+               (visible * bsdf_pdf * power_heuristic(pdf, bsdf_pdf) / pdf);
+      },
+      lights.lights[index]);
+}
+
+/** Shade the closest hit of a path: add the light the hit point emits and,
+    on diffuse surfaces, the light it receives directly, then scatter the
+    ray
+
+    \param[inout] cur_ray is the ray of the path, replaced by the scattered
+    one
+
+    \param[in] rec is the closest hit, whose footprint is set from the ray
+    cone of the path
+
+    \return false when the path ends
+*/
+template <typename Material>
+inline bool shade_hit(auto& ctx, const Material& material,
+                      auto& hittables_acc, auto& material_acc,
+                      const auto& lights, bool light_sampling, ray& cur_ray,
+                      hit_record rec, path_state& path) {
+  path.cone_width +=
+      path.cone_spread * rec.t * sycl::length(cur_ray.direction());
+  rec.footprint = path.cone_width;
+  if constexpr (std::is_same_v<Material, lightsource_material>) {
+    auto weight = 1.0f;
+    // This light might also have been sampled from the previous bounce
+    if (path.bsdf_pdf > 0)
+      weight = power_heuristic(
+          path.bsdf_pdf, light_list_pdf(lights, cur_ray, rec, material.light));
+    path.radiance += path.throughput * material.emitted(ctx, rec) * weight;
+  }
+  color attenuation { 1.0f, 1.0f, 1.0f };
+  ray scattered;
+  ctx.counters.add(instrumentation::scatters +
+                   instrumentation::material_index<Material>);
+  if (!material.scatter(ctx, cur_ray, rec, attenuation, scattered)) {
+    ctx.counters.add(instrumentation::absorbed_paths);
+    return false;
+  }
+  path.bsdf_pdf = 0;
+  if constexpr (std::is_same_v<Material, lambertian_material>) {
+    if (light_sampling && lights.count) {
+      // The attenuation of a lambertian bounce is its albedo
+      path.radiance += path.throughput * attenuation *
+                       sample_direct_light(ctx, hittables_acc, material_acc,
+                                           lights, cur_ray, rec);
+      path.bsdf_pdf = sycl::fmax(
+          0.f, dot(rec.normal, unit_vector(scattered.direction())) / pi);
+    }
+  }
+  path.throughput *= attenuation;
+  cur_ray = scattered;
+  return true;
+}
+
+/** Russian roulette: once a path has bounced roulette_depth times, end it
+    with a probability growing as its throughput decreases
+
+    The throughput of the surviving paths is divided by their probability to
+    survive, so the expected image does not change.
+
+    \param[in] bounce is the index of the bounce just done, from 0
+
+    \return false when the path ends
+*/
+inline bool survive_roulette(auto& ctx, path_state& path, int bounce,
+                             int roulette_depth) {
+  if (bounce + 1 < roulette_depth)
+    return true;
+  const auto& t = path.throughput;
+  const auto survival =
+      sycl::fmin(0.95f, sycl::fmax(t.x(), sycl::fmax(t.y(), t.z())));
+  if (!(ctx.rng.float_t() < survival)) {
+    ctx.counters.add(instrumentation::roulette_paths);
+    return false;
+  }
+  path.throughput /= survival;
+  return true;
+}
+
+/** Compute params.samples paths through a pixel and return the sum of their
+    colors
 
+    With buildparams::packet_size, the primary rays are traced by packets of
+    this size and only the following bounces are traced ray by ray, since
+    the samples of a pixel are very coherent until their first bounce.
+
+    With params.light_sampling, the lights are sampled directly at each
+    diffuse bounce, combined with the paths finding the lights by themselves
+    with multiple importance sampling.
+
+    After params.roulette_depth bounces, the paths are ended by Russian
+    roulette.
+
+    \param[in] params is a render_parameters or a static_render_parameters
+
+    \param[inout] stats is updated with each sample
+*/
+inline color render_pixel(auto& ctx, int x_coord, int y_coord,
+                          camera const& cam, auto& hittables_acc,
+                          auto& material_acc, const auto& lights,
+                          const auto& params, pixel_statistics& stats) {
+  auto& rng = ctx.rng;
+  // The closest hit of the ray may already be known from a packet. The
+  // number of rays traced is returned in path_length
+  auto get_color = [&](const ray& r, int& path_length,
+                       const traced_hit* primary = nullptr) {
     ray cur_ray = r;
-    color cur_attenuation { 1.0f, 1.0f, 1.0f };
-    ray scattered;
-    color emitted;
-    material_t material_type;
-    for (auto i = 0; i < depth; i++) {
+    path_state path;
+    path.cone_spread = cam.pixel_spread(params.height);
+    path_length = params.depth;
+    ctx.counters.add(instrumentation::paths);
+    for (auto i = 0; i < params.depth; i++) {
       hit_record rec;
-      if (hit_world(cur_ray, rec, material_type)) {
-        emitted = dev_visit([&](auto&& arg) { return arg.emitted(ctx, rec); },
-                            material_type);
-        if (dev_visit(
-                [&](auto&& arg) {
-                  return arg.scatter(ctx, cur_ray, rec, cur_attenuation,
-                                     scattered);
-                },
-                material_type)) {
-          // On hitting the object, the ray gets scattered
-          cur_ray = scattered;
-        } else {
-          // Ray did not get scattered or reflected
-          return emitted;
-        }
-      } else {
-        /**
-         If ray doesn't hit anything during iteration linearly blend white and
-         blue color depending on the height of the y coordinate after scaling
-         the ray direction to unit length. While -1.0f < y < 1.0f, hit_pt is
-         between 0 and 1. This produces a blue to white gradient in the
-         background
-         */
-        vec unit_direction = unit_vector(cur_ray.direction());
-        auto hit_pt = 0.5f * (unit_direction.y() + 1.0f);
-        color c = (1.0f - hit_pt) * color { 1.0f, 1.0f, 1.0f } +
-                  hit_pt * color { 0.5f, 0.7f, 1.0f };
-        return cur_attenuation * c;
+      bool hit;
+      if (i == 0 && primary) {
+        hit = primary->hit;
+        rec = primary->rec;
+      } else
+        hit = hit_world(ctx, hittables_acc, cur_ray, rec);
+      if (!hit) {
+        path.radiance += path.throughput * background(cur_ray);
+        path_length = i + 1;
+        return path.radiance;
+      }
+      // Only the material of the closest hit is looked up
+      if (!dev_visit(
+              [&](auto&& material) {
+                return shade_hit(ctx, material, hittables_acc, material_acc,
+                                 lights, params.light_sampling, cur_ray, rec,
+                                 path);
+              },
+              material_acc[rec.material]) ||
+          !survive_roulette(ctx, path, i, params.roulette_depth)) {
+        // Ray did not get scattered or reflected, or was ended
+        path_length = i + 1;
+        return path.radiance;
       }
     }
-    // If not returned within max_depth return black
-    return color { 0.0f, 0.0f, 0.0f };
+    // Nothing more is gathered beyond the maximum depth
+    ctx.counters.add(instrumentation::max_depth_paths);
+    return path.radiance;
   };
 
   color final_color(0.0f, 0.0f, 0.0f);
-  for (auto i = 0; i < samples; i++) {
-    const auto u = (x_coord + rng.float_t()) / width;
-    const auto v = (y_coord + rng.float_t()) / height;
-    // u and v are points on the viewport
-    ray r = cam.get_ray(u, v, rng);
-    final_color += get_color(r);
+  if constexpr (buildparams::packet_size > 0) {
+    constexpr int packet_size = buildparams::packet_size;
+    for (auto first = 0; first < params.samples; first += packet_size) {
+      const auto nb_rays = sycl::min(packet_size, params.samples - first);
+      ray rays[packet_size];
+      for (auto i = 0; i < nb_rays; i++) {
+        const auto u = (x_coord + rng.float_t()) / params.width;
+        const auto v = (y_coord + rng.float_t()) / params.height;
+        rays[i] = cam.get_ray(u, v, rng);
+      }
+      ray_packet<packet_size> packet;
+      packet.set(rays, nb_rays);
+      std::array<traced_hit, packet_size> primary;
+      hit_world_packet(ctx, hittables_acc, packet, primary);
+      for (auto i = 0; i < nb_rays; i++) {
+        int path_length;
+        auto sample = get_color(rays[i], path_length, &primary[i]);
+        stats.add(sample, path_length);
+        final_color += sample;
+      }
+    }
+  } else {
+    for (auto i = 0; i < params.samples; i++) {
+      const auto u = (x_coord + rng.float_t()) / params.width;
+      const auto v = (y_coord + rng.float_t()) / params.height;
+      // u and v are points on the viewport
+      ray r = cam.get_ray(u, v, rng);
+      int path_length;
+      auto sample = get_color(r, path_length);
+      stats.add(sample, path_length);
+      final_color += sample;
+    }
   }
-  final_color /= static_cast<real_t>(samples);
-
-  // Write final color to the frame buffer global memory
-  fb_acc[y_coord][x_coord] = final_color;
+  return final_color;
 }
 
-struct PixelRender;
+template <typename RenderParameters> class PixelRender;
+
+/** Call pixel_kernel(x_coord, y_coord) on each pixel of the image, with the
+    execution strategy selected at build time
 
-template <int width, int height, int samples, int depth>
-inline void executor(sycl::handler& cgh, camera const& cam_ptr,
-                     auto& hittable_acc, auto& fb_acc, auto& texture_acc) {
+    \param[in] tile_queues_acc is an accessor to the tile queues, only used by
+    the tiled executor
+
+    \param[in] params gives the image size
+*/
+template <typename KernelName>
+inline void executor(sycl::handler& cgh, auto& tile_queues_acc,
+                     const auto& params, auto pixel_kernel) {
   if constexpr (buildparams::use_single_task) {
-    cgh.single_task<PixelRender>([=] {
-      LocalPseudoRNG rng;
-      task_context ctx { rng, texture_acc.get_pointer() };
+    cgh.single_task<KernelName>([=] {
+      const int width = params.width;
+      const int height = params.height;
       for (int x_coord = 0; x_coord != width; ++x_coord)
-        for (int y_coord = 0; y_coord != height; ++y_coord) {
-          render_pixel<width, height, samples, depth>(
-              ctx, x_coord, y_coord, cam_ptr, hittable_acc, fb_acc);
-        }
+        for (int y_coord = 0; y_coord != height; ++y_coord)
+          pixel_kernel(x_coord, y_coord);
     });
+  } else if constexpr (buildparams::use_tiled_executor) {
+    constexpr int tile_size = buildparams::tile_size;
+    const auto nb_workers = tile_queues_acc.get_count();
+
+    cgh.parallel_for<KernelName>(
+        sycl::range<1>(nb_workers), [=](sycl::item<1> item) {
+          const int width = params.width;
+          const int height = params.height;
+          const int nb_tiles_x = (width + tile_size - 1) / tile_size;
+          const std::uint32_t worker = item.get_linear_id();
+          std::uint32_t tile;
+          while (tile_scheduler::next_tile(tile_queues_acc, worker, tile)) {
+            const int x0 = (tile % nb_tiles_x) * tile_size;
+            const int y0 = (tile / nb_tiles_x) * tile_size;
+            const int x1 = sycl::min(x0 + tile_size, width);
+            const int y1 = sycl::min(y0 + tile_size, height);
+            for (int y_coord = y0; y_coord < y1; ++y_coord)
+              for (int x_coord = x0; x_coord < x1; ++x_coord)
+                pixel_kernel(x_coord, y_coord);
+          }
+        });
   } else {
-    const auto global = sycl::range<2>(height, width);
+    const auto global = sycl::range<2>(params.height, params.width);
 
-    cgh.parallel_for<PixelRender>(global, [=](sycl::item<2> item) {
+    cgh.parallel_for<KernelName>(global, [=](sycl::item<2> item) {
       auto gid = item.get_id();
-      const auto x_coord = gid[1];
-      const auto y_coord = gid[0];
-      auto init_generator_state =
-          std::hash<std::size_t> {}(item.get_linear_id());
-      LocalPseudoRNG rng(init_generator_state);
-      task_context ctx { rng, texture_acc.get_pointer() };
-      render_pixel<width, height, samples, depth>(
-          ctx, x_coord, y_coord, cam_ptr, hittable_acc, fb_acc);
+      pixel_kernel(gid[1], gid[0]);
     });
   }
 }
 
-// Render function to call the render kernel
-template <int width, int height, int samples>
-void render(sycl::queue& queue, sycl::buffer<color, 2>& frame_buf,
-            std::vector<hittable_t>& hittables, camera& cam) {
-  auto constexpr depth = 50;
-  const auto nb_hittable = hittables.size();
-  auto hittables_buf = sycl::buffer<hittable_t, 1>(hittables.data(),
-                                                   sycl::range<1>(nb_hittable));
-  auto texture_buf = image_texture::freeze();
-
-  // Submit command group on device
+/// Primitives already in the order of the leaves of their BVH, with the BVH
+template <typename Primitive> struct bvh_ordered {
+  std::span<const Primitive> primitives;
+  std::span<const bvh_node> nodes;
+};
+
+/** Device buffers for the primitives of one type
+
+    The primitives are reordered to follow the leaves of their BVH, which is
+    built on the host, unless they come already ordered.
+*/
+template <typename Primitive> class primitive_buffers {
+  static std::vector<aabb> bounding_boxes(const std::vector<Primitive>& p) {
+    std::vector<aabb> boxes;
+    boxes.reserve(p.size());
+    for (const auto& primitive : p)
+      boxes.push_back(primitive.bounding_box());
+    return boxes;
+  }
+
+  static std::vector<Primitive> reorder(const std::vector<Primitive>& p,
+                                        const bvh& accel) {
+    std::vector<Primitive> ordered;
+    ordered.reserve(p.size());
+    for (auto i : accel.primitive_indices)
+      ordered.push_back(p[i]);
+    // A buffer cannot be empty, but the empty root leaf never reads this
+    if (ordered.empty())
+      ordered.emplace_back();
+    return ordered;
+  }
+
+ public:
+  explicit primitive_buffers(const std::vector<Primitive>& primitives)
+      : accel { bounding_boxes(primitives) }
+      , ordered { reorder(primitives, accel) }
+      , data { ordered, accel.nodes }
+      , primitive_buf { data.primitives.data(),
+                        sycl::range<1>(data.primitives.size()) }
+      , bvh_buf { data.nodes.data(), sycl::range<1>(data.nodes.size()) } {}
+
+  /// Use ordered primitives without copying them, so they must outlive the
+  /// buffers
+  explicit primitive_buffers(const bvh_ordered<Primitive>& prebuilt)
+      : data { prebuilt }
+      , primitive_buf { data.primitives.data(),
+                        sycl::range<1>(data.primitives.size()) }
+      , bvh_buf { data.nodes.data(), sycl::range<1>(data.nodes.size()) } {}
+
+  primitive_buffers(const primitive_buffers&) = delete;
+
+  /// Get the device view of the primitives
+  auto get_access(sycl::handler& cgh) {
+    return primitive_view {
+      primitive_buf.template get_access<sycl::access::mode::read>(cgh),
+      bvh_buf.template get_access<sycl::access::mode::read>(cgh)
+    };
+  }
+
+  /** Fit the BVH to a shutter interval, such as the one of a frame of an
+      animation, for the primitive types whose bounds depend on time
+
+      The primitives and the tree are kept and only the bounds of the nodes
+      are written, so the device buffers stay in place. The other types are
+      left untouched.
+  */
+  void refit(real_t time0, real_t time1) {
+    if constexpr (requires(const Primitive& p) {
+                    p.bounding_box(time0, time1);
+                  }) {
+      // The nodes of a prebuilt BVH, such as a mapped scene cache, are read
+      // only, so they are copied once
+      if (accel.nodes.empty()) {
+        accel.nodes.assign(data.nodes.begin(), data.nodes.end());
+        data.nodes = accel.nodes;
+        bvh_buf = { accel.nodes.data(), sycl::range<1>(accel.nodes.size()) };
+      }
+      auto nodes = bvh_buf.template get_access<sycl::access::mode::read_write>();
+      bvh_refit(nodes, data.nodes.size(), [&](std::uint32_t i) {
+        return data.primitives[i].bounding_box(time0, time1);
+      });
+    }
+  }
+
+  /// The host data of the buffers
+  const bvh_ordered<Primitive>& host_data() const { return data; }
+
+  /// Number of bytes used on the device by the primitives and their BVH
+  std::size_t memory_size() const {
+    return data.primitives.size_bytes() + data.nodes.size_bytes();
+  }
+
+ private:
+  bvh accel;
+  std::vector<Primitive> ordered;
+  bvh_ordered<Primitive> data;
+  sycl::buffer<Primitive, 1> primitive_buf;
+  sycl::buffer<bvh_node, 1> bvh_buf;
+};
+
+/// Print the memory used by each primitive type of a scene
+template <typename... Primitives>
+void print_memory_report(std::ostream& out,
+                         const hittable_list<Primitives...>& hittables) {
+  auto report = [&]<typename Primitive>(const std::vector<Primitive>& p) {
+    if (!p.empty())
+      out << primitive_name<Primitive> << ": " << p.size() << " x "
+          << sizeof(Primitive) << " B = " << p.size() * sizeof(Primitive)
+          << " B\n";
+  };
+  hittables.for_each_type(report);
+  out << "total: " << hittables.size() << " primitives, "
+      << hittables.memory_size() << " B\n";
+}
+
+/// The accessors to the texture data and to the pages of the streamed
+/// textures
+template <typename Data, typename Pool, typename Table, typename Usage>
+struct texture_access {
+  Data data;
+  Pool pool;
+  Table table;
+  Usage usage;
+
+  auto get_pointer() const { return data.get_pointer(); }
+
+  texture_page_view pages() const {
+    return { pool.get_pointer(), table.get_pointer(), usage.get_pointer() };
+  }
+};
+
+/** The scene uploaded to the device
+
+    It is built once and then used by all the rendering passes.
+*/
+template <typename... Primitives> class device_scene {
+ public:
+  /// The materials and the textures must outlive the device scene, and the
+  /// lights must have their own material, see separate_light_materials()
+  device_scene(const hittable_list<Primitives...>& hittables,
+               const material_table& materials, texture_table& textures)
+      : hittables_bufs { hittables.template get<Primitives>()... }
+      , lights { make_light_list(hittables, materials) }
+      , nb_lights { static_cast<std::uint32_t>(lights.size()) }
+      , material_data { materials.data(), materials.size() }
+      , texture_data { textures.freeze_data() }
+      , light_data { pad(lights) }
+      , store { &textures.page_store() }
+      , page_pool(std::max<std::size_t>(
+            store->pool_slots() * texture_store::page_size, 1))
+      , page_table(std::max<std::size_t>(store->page_count(), 1),
+                   texture_store::not_resident)
+      , page_usage(page_table.size())
+      , material_buf { make_buffer(material_data) }
+      , texture_buf { texture_data.data(),
+                      sycl::range<2>(texture_data.size() / 3, 3) }
+      , light_buf { make_buffer(light_data) }
+      , page_pool_buf { page_pool.data(), sycl::range<1>(page_pool.size()) }
+      , page_table_buf { page_table.data(),
+                         sycl::range<1>(page_table.size()) }
+      , page_usage_buf { page_usage.data(),
+                         sycl::range<1>(page_usage.size()) } {}
+
+  /** Use a scene already laid out for the device without copying it, such as
+      a scene_cache, which must outlive the device scene
+
+      \param[in] prebuilt provides the same data as the host_*() methods
+  */
+  template <typename Prebuilt>
+  explicit device_scene(const Prebuilt& prebuilt)
+      : hittables_bufs { prebuilt.template primitives<Primitives>()... }
+      , nb_lights { prebuilt.light_count() }
+      , material_data { prebuilt.host_materials() }
+      , texture_data { prebuilt.host_textures() }
+      , light_data { prebuilt.host_lights() }
+      , page_pool(1)
+      , page_table(1, texture_store::not_resident)
+      , page_usage(1)
+      , material_buf { make_buffer(material_data) }
+      , texture_buf { texture_data.data(),
+                      sycl::range<2>(texture_data.size() / 3, 3) }
+      , light_buf { make_buffer(light_data) }
+      , page_pool_buf { page_pool.data(), sycl::range<1>(page_pool.size()) }
+      , page_table_buf { page_table.data(),
+                         sycl::range<1>(page_table.size()) }
+      , page_usage_buf { page_usage.data(),
+                         sycl::range<1>(page_usage.size()) } {}
+
+  auto get_hittables_access(sycl::handler& cgh) {
+    return std::apply(
+        [&](auto&... bufs) { return std::tuple { bufs.get_access(cgh)... }; },
+        hittables_bufs);
+  }
+
+  auto get_material_access(sycl::handler& cgh) {
+    return material_buf.get_access<sycl::access::mode::read>(cgh);
+  }
+
+  auto get_texture_access(sycl::handler& cgh) {
+    return texture_access {
+      texture_buf.get_access<sycl::access::mode::read>(cgh),
+      page_pool_buf.get_access<sycl::access::mode::read>(cgh),
+      page_table_buf.get_access<sycl::access::mode::read>(cgh),
+      page_usage_buf.get_access<sycl::access::mode::read_write>(cgh)
+    };
+  }
+
+  /// Fit the BVH of the moving primitives to a shutter interval, see
+  /// primitive_buffers::refit
+  void refit(real_t time0, real_t time1) {
+    std::apply([&](auto&... bufs) { (bufs.refit(time0, time1), ...); },
+               hittables_bufs);
+  }
+
+  /// Load the pages of the streamed textures used by the last pass and
+  /// evict the least recently used ones, see texture_store
+  void update_texture_pages() {
+    if (!store || !store->page_count())
+      return;
+    auto usage = page_usage_buf.get_access<sycl::access::mode::read_write>();
+    auto table = page_table_buf.get_access<sycl::access::mode::read_write>();
+    auto pool = page_pool_buf.get_access<sycl::access::mode::read_write>();
+    store->update(&usage[0], &table[0], &pool[0]);
+  }
+
+  /// Get the device view of the lights to sample
+  auto get_light_access(sycl::handler& cgh) {
+    return light_view { light_buf.get_access<sycl::access::mode::read>(cgh),
+                        nb_lights };
+  }
+
+  /// The primitives of a type in BVH order, with their BVH
+  template <typename Primitive>
+  const bvh_ordered<Primitive>& primitives() const {
+    return std::get<primitive_buffers<Primitive>>(hittables_bufs).host_data();
+  }
+
+  std::span<const material_t> host_materials() const { return material_data; }
+
+  std::span<const std::uint8_t> host_textures() const { return texture_data; }
+
+  /// The lights to sample, padded to one light when there is none
+  std::span<const light_t> host_lights() const { return light_data; }
+
+  std::uint32_t light_count() const { return nb_lights; }
+
+ private:
+  /// A buffer cannot be empty, but the padding light is never read
+  static std::span<const light_t> pad(std::vector<light_t>& v) {
+    if (v.empty())
+      v.emplace_back();
+    return v;
+  }
+
+  template <typename T>
+  static sycl::buffer<T, 1> make_buffer(std::span<const T> data) {
+    return { data.data(), sycl::range<1>(data.size()) };
+  }
+
+  std::tuple<primitive_buffers<Primitives>...> hittables_bufs;
+  /// The lights found in the scene, when it is not prebuilt
+  std::vector<light_t> lights;
+  std::uint32_t nb_lights;
+  std::span<const material_t> material_data;
+  std::span<const std::uint8_t> texture_data;
+  std::span<const light_t> light_data;
+  /// The residency of the streamed textures, nullptr when prebuilt
+  texture_store* store = nullptr;
+  /// The pages of the streamed textures, only 1 padding element each when
+  /// no texture is streamed
+  std::vector<std::uint8_t> page_pool;
+  std::vector<std::uint32_t> page_table;
+  std::vector<std::uint32_t> page_usage;
+  sycl::buffer<material_t, 1> material_buf;
+  sycl::buffer<uint8_t, 2> texture_buf;
+  sycl::buffer<light_t, 1> light_buf;
+  sycl::buffer<std::uint8_t, 1> page_pool_buf;
+  sycl::buffer<std::uint32_t, 1> page_table_buf;
+  sycl::buffer<std::uint32_t, 1> page_usage_buf;
+};
+
+/// The device_scene type of a hittable_list type
+template <typename HittableList> struct device_scene_of;
+
+template <typename... Primitives>
+struct device_scene_of<hittable_list<Primitives...>> {
+  using type = device_scene<Primitives...>;
+};
+
+/// Number of workers of the tiled executor, one per compute unit
+inline std::uint32_t nb_tile_workers(sycl::queue& queue,
+                                     std::uint32_t nb_tiles) {
+  if constexpr (!buildparams::use_tiled_executor)
+    return 1;
+  return sycl::min(
+      nb_tiles,
+      queue.get_device().get_info<sycl::info::device::max_compute_units>());
+}
+
+/** Add params.samples paths per pixel to the accumulation buffer
+
+    The random generator of each pixel continues from where the previous pass
+    left it.
+
+    With adaptive sampling, the converged pixels are skipped and the others
+    get more samples to keep the same total number of samples per pass.
+
+    \param[in] params is a render_parameters or a static_render_parameters,
+    the latter giving a kernel specialized for these values
+*/
+void render_pass_with(sycl::queue& queue, auto& scene, const camera& cam,
+                      accumulation_buffer& accum, const auto& params,
+                      const adaptive_sampling& adaptive) {
+  using params_t = std::decay_t<decltype(params)>;
+  constexpr auto tile_size = buildparams::tile_size;
+  const int width = params.width;
+  const int height = params.height;
+  const std::uint32_t nb_tiles = ((width + tile_size - 1) / tile_size) *
+                                 ((height + tile_size - 1) / tile_size);
+  const auto nb_workers = nb_tile_workers(queue, nb_tiles);
+  auto tile_queues = tile_scheduler::make_queues(nb_tiles, nb_workers);
+  auto tile_queues_buf = sycl::buffer<std::uint64_t, 1>(
+      tile_queues.data(), sycl::range<1>(nb_workers));
+
+  // Redistribute the samples of the converged pixels
+  const std::uint32_t nb_pixels = width * height;
+  const float boost = adaptive.boost(nb_pixels, accum.active_pixels);
+  // Count the pixels still to be sampled in the next pass. The buffer is
+  // destroyed at the end of the scope, which waits for the result
+  std::uint32_t active_pixels = 0;
+  {
+    auto active_buf =
+        sycl::buffer<std::uint32_t, 1>(&active_pixels, sycl::range<1>(1));
+    // Submit command group on device
+    queue.submit([&](sycl::handler& cgh) {
+      auto sum_acc =
+          accum.sum.get_access<sycl::access::mode::read_write>(cgh);
+      auto rng_acc =
+          accum.rng_state.get_access<sycl::access::mode::read_write>(cgh);
+      auto stats_acc =
+          accum.statistics.get_access<sycl::access::mode::read_write>(cgh);
+      auto active_acc =
+          active_buf.get_access<sycl::access::mode::read_write>(cgh);
+      auto hittables_acc = scene.get_hittables_access(cgh);
+      auto material_acc = scene.get_material_access(cgh);
+      auto light_acc = scene.get_light_access(cgh);
+      auto texture_acc = scene.get_texture_access(cgh);
+      auto tile_queues_acc =
+          tile_queues_buf.get_access<sycl::access::mode::read_write>(cgh);
+      auto counters_acc =
+          accum.counters.get_access<sycl::access::mode::read_write>(cgh);
+
+      executor<PixelRender<params_t>>(
+          cgh, tile_queues_acc, params, [=](int x_coord, int y_coord) {
+            pixel_statistics stats = stats_acc[y_coord][x_coord];
+            const auto threshold = adaptive.threshold;
+            const auto min_samples = adaptive.min_samples;
+            if (adaptive.enabled() && stats.converged(threshold, min_samples))
+              return;
+            LocalPseudoRNG rng(rng_acc[y_coord][x_coord]);
+            render_context ctx { { rng, texture_acc.get_pointer(),
+                                   texture_acc.pages() } };
+            color sum = sum_acc[y_coord][x_coord];
+            auto rounds = static_cast<std::uint32_t>(boost);
+            if (boost > rounds && ctx.rng.float_t() < boost - rounds)
+              ++rounds;
+            for (std::uint32_t i = 0; i < rounds; ++i)
+              sum += render_pixel(ctx, x_coord, y_coord, cam, hittables_acc,
+                                  material_acc, light_acc, params, stats);
+            sum_acc[y_coord][x_coord] = sum;
+            rng_acc[y_coord][x_coord] = ctx.rng.state();
+            stats_acc[y_coord][x_coord] = stats;
+            instrumentation::add_to_pixel(counters_acc, y_coord, x_coord,
+                                          ctx.counters);
+            if (adaptive.enabled() && !stats.converged(threshold, min_samples))
+              sycl::atomic_ref<std::uint32_t, sycl::memory_order::relaxed,
+                               sycl::memory_scope::device,
+                               sycl::access::address_space::global_space> {
+                active_acc[0]
+              }++;
+          });
+    });
+  }
+  accum.sample_count += params.samples;
+  accum.active_pixels = adaptive.enabled() ? active_pixels : nb_pixels;
+}
+
+/** Add params.samples paths per pixel to the accumulation buffer
+
+    A kernel specialized at compile time is used when params is one of the
+    specialized_render_parameters and buildparams::use_specialized_kernels
+    is set, unless generic is true.
+*/
+inline void render_pass(sycl::queue& queue, auto& scene, const camera& cam,
+                        accumulation_buffer& accum,
+                        const render_parameters& params,
+                        const adaptive_sampling& adaptive = {},
+                        bool generic = false) {
+  if constexpr (buildparams::use_specialized_kernels) {
+    if (!generic) {
+      auto try_specialized = [&](auto specialized) {
+        if (render_parameters(specialized) != params)
+          return false;
+        render_pass_with(queue, scene, cam, accum, specialized, adaptive);
+        return true;
+      };
+      if (std::apply([&](auto... s) { return (try_specialized(s) || ...); },
+                     specialized_render_parameters {}))
+        return;
+    }
+  }
+  render_pass_with(queue, scene, cam, accum, params, adaptive);
+}
+
+struct ResolveFrame;
+
+/// Write the average color of each pixel of the accumulation buffer
+inline void resolve(sycl::queue& queue, accumulation_buffer& accum,
+                    sycl::buffer<color, 2>& frame_buf) {
   queue.submit([&](sycl::handler& cgh) {
+    auto sum_acc = accum.sum.get_access<sycl::access::mode::read>(cgh);
+    auto stats_acc = accum.statistics.get_access<sycl::access::mode::read>(cgh);
     auto fb_acc = frame_buf.get_access<sycl::access::mode::discard_write>(cgh);
-    auto hittables_acc =
-        hittables_buf.get_access<sycl::access::mode::read>(cgh);
-    auto texture_acc = texture_buf.get_access<sycl::access::mode::read>(cgh);
-
-    executor<width, height, samples, depth>(cgh, cam, hittables_acc, fb_acc,
-                                            texture_acc);
+    cgh.parallel_for<ResolveFrame>(
+        frame_buf.get_range(), [=](sycl::item<2> item) {
+          const auto count = stats_acc[item.get_id()].count;
+          fb_acc[item.get_id()] =
+              count ? sum_acc[item.get_id()] / static_cast<real_t>(count)
+                    : color { 0.0f, 0.0f, 0.0f };
+        });
   });
 }
+
+// Render function to call the render kernel in a single pass
+template <typename... Primitives>
+void render(sycl::queue& queue, sycl::buffer<color, 2>& frame_buf,
+            const hittable_list<Primitives...>& hittables,
+            const material_table& materials, texture_table& textures,
+            camera& cam, const render_parameters& params) {
+  device_scene scene { hittables, materials, textures };
+  accumulation_buffer accum { static_cast<std::size_t>(params.width),
+                              static_cast<std::size_t>(params.height) };
+  render_pass(queue, scene, cam, accum, params);
+  resolve(queue, accum, frame_buf);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef RT_SYCL_RENDER_PARAMETERS_HPP
+#define RT_SYCL_RENDER_PARAMETERS_HPP
+
+#include <tuple>
+
+#include "build_parameters.hpp"
+
+/** Image size, samples per pixel per pass and maximum path depth of a
+    render, chosen at run time
+*/
+struct render_parameters {
+  int width = buildparams::output_width;
+  int height = buildparams::output_height;
+  /// Samples per pixel in each pass
+  int samples = 10;
+  /// Maximum number of bounces of a path
+  int depth = 50;
+  /// Sample the lights directly at each diffuse bounce
+  bool light_sampling = true;
+  /// Number of bounces before ending paths by Russian roulette, which is
+  /// disabled when this is not below depth
+  int roulette_depth = 3;
+
+  bool operator==(const render_parameters&) const = default;
+};
+
+/** The same parameters fixed at compile time
+
+    The kernels are written against the members of the parameters, so with
+    this type the compiler sees constants and can fold the image size and
+    unroll the sample loop.
+*/
+template <int Width, int Height, int Samples, int Depth,
+          bool LightSampling = true, int RouletteDepth = 3>
+struct static_render_parameters {
+  static constexpr int width = Width;
+  static constexpr int height = Height;
+  static constexpr int samples = Samples;
+  static constexpr int depth = Depth;
+  static constexpr bool light_sampling = LightSampling;
+  static constexpr int roulette_depth = RouletteDepth;
+
+  constexpr operator render_parameters() const {
+    return { width, height, samples, depth, light_sampling, roulette_depth };
+  }
+};
+
+/** The configurations with a specialized kernel when
+    buildparams::use_specialized_kernels is set
+
+    Each entry instantiates the whole rendering kernel, so keep this list to
+    the few configurations that really matter for performance.
+*/
+using specialized_render_parameters =
+    std::tuple<static_render_parameters<buildparams::output_width,
+                                        buildparams::output_height, 10, 50>>;
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -56,14 +57,14 @@ class LocalPseudoRNG {
     return vec_t() * scale + min;
   }
 
-  // Returns a random unit vector
+  // Returns a random unit vector, uniformly distributed on the sphere so that
+  // normal + unit_vec() follows the cosine distribution expected for
+  // lambertian scattering
   inline vec unit_vec() {
-    auto x = float_t(-1.f, 1.f);
-    auto maxy = sycl::sqrt(1 - x * x);
-    auto y = float_t(-maxy, maxy);
-    auto absz = sycl::sqrt(maxy * maxy - y * y);
-    auto z = (float_t() > 0.5) ? absz : -absz;
-    return vec(x, y, z);
+    auto z = float_t(-1.f, 1.f);
+    auto phi = float_t(0, 2 * pi);
+    auto r = sycl::sqrt(sycl::fmax(0.f, 1 - z * z));
+    return vec(r * sycl::cos(phi), r * sycl::sin(phi), z);
   }
 
   // Returns a random vector in the unit ball of usual norm
@@ -87,10 +88,23 @@ class LocalPseudoRNG {
     return { x, y, 0.f };
   }
 
+  // Returns the internal state, to continue the sequence later
+  inline xorshift<>::value_type state() const { return generator.state; }
+
  private:
   xorshift<> generator;
 };
 
+/// Device view of the pages of the streamed textures, see texture_store.hpp
+struct texture_page_view {
+  /// The pages in their slots
+  sycl::global_ptr<uint8_t> pool;
+  /// The slot of each page
+  sycl::global_ptr<std::uint32_t> table;
+  /// Set for the pages used by the pass
+  sycl::global_ptr<std::uint32_t> usage;
+};
+
 /**
  @brief Used as a poorman's cooperative ersatz of device global variable
         The task context is (manually) passed through the call stack to all
@@ -100,6 +114,7 @@ struct task_context {
   LocalPseudoRNG rng;
   // See image_texture in texture.hpp for more details
   sycl::global_ptr<uint8_t> texture_data;
+  texture_page_view texture_pages;
 };
 
 // Common Headers
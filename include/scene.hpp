@@ -0,0 +1,129 @@
+#ifndef RT_SYCL_SCENE_HPP
+#define RT_SYCL_SCENE_HPP
+
+#include <cstddef>
+#include <optional>
+
+#include "accumulation_buffer.hpp"
+#include "build_parameters.hpp"
+#include "camera.hpp"
+#include "material.hpp"
+#include "render.hpp"
+#include "render_parameters.hpp"
+#include "scene_cache.hpp"
+#include "scene_loader.hpp"
+#include "sycl.hpp"
+#include "texture.hpp"
+#include "wavefront.hpp"
+
+/** A scene with everything it owns: its objects, materials and textures on
+    the host, then their buffers on the device
+
+    Nothing is shared between scenes, so several ones can be built, rendered
+    concurrently on their own queues and destroyed independently in the same
+    process.
+
+    A scene is first filled, either by adding to its tables, by load() or by
+    map_cache(), then uploaded once to the device and rendered by any number
+    of passes. The device buffers refer to the host tables, so a scene cannot
+    be copied nor moved.
+*/
+class scene {
+ public:
+  using device_type = device_scene_of<scene_hittables>::type;
+
+  /// Graphical objects
+  scene_hittables hittables;
+  /// Their materials, shared between objects
+  material_table materials;
+  /// The image textures used by the materials
+  texture_table textures;
+  /// The camera, whose defaults match the built-in scene
+  camera_parameters view;
+
+  scene() = default;
+  scene(const scene&) = delete;
+  scene& operator=(const scene&) = delete;
+
+  /// Add the content of a scene file, see load_scene()
+  bool load(const char* file_name) {
+    return load_scene(file_name, hittables, materials, textures, view);
+  }
+
+  /** Use the scene stored in a cache file instead of the tables, which stay
+      empty, see scene_cache
+
+      \return false after printing an error if the cache cannot be used
+  */
+  bool map_cache(const char* cache_file) {
+    if (!cache.open(cache_file))
+      return false;
+    view = cache.camera();
+    device.emplace(cache);
+    mapped = true;
+    return true;
+  }
+
+  /// Upload the tables to the device, decoding the textures. Nothing can be
+  /// added to the scene afterwards
+  void upload() {
+    separate_light_materials(hittables, materials);
+    device.emplace(hittables, materials, textures);
+  }
+
+  /** Write the uploaded scene to a cache file
+
+      \param[in] scene_file is the file the scene was loaded from, nullptr
+      for the built-in scene, recorded to only reuse the cache for it
+  */
+  bool save_cache(const char* cache_file, const char* scene_file) const {
+    return scene_cache<scene_hittables>::save(cache_file, *device, view,
+                                              scene_file);
+  }
+
+  /// Number of primitives, either in the tables or in the cache
+  std::size_t size() const { return mapped ? cache.size() : hittables.size(); }
+
+  /// The streamed texture pages, empty when mapped from a cache
+  const texture_store& page_store() { return textures.page_store(); }
+
+  device_type& on_device() { return *device; }
+
+  /** Move the uploaded scene to the shutter interval of a frame
+
+      Only the bounds of the BVH of the moving primitives are updated, the
+      other buffers staying on the device from one frame to the next.
+  */
+  void set_shutter(real_t time0, real_t time1) { device->refit(time0, time1); }
+
+  /** Add a rendering pass to an accumulation buffer and update the texture
+      pages it used
+
+      The scene must be uploaded. It is rendered by one thread at a time,
+      while other scenes can be rendered concurrently.
+  */
+  void render(sycl::queue& queue, const camera& cam,
+              accumulation_buffer& accum, const render_parameters& params,
+              const adaptive_sampling& adaptive = {}, bool generic = false) {
+    if constexpr (buildparams::use_wavefront_executor) {
+      const std::size_t nb_pixels = params.width * params.height;
+      if (!paths || paths->capacity() < nb_pixels)
+        paths.emplace(nb_pixels);
+      render_pass_wavefront(queue, *device, *paths, cam, accum, params,
+                            adaptive);
+    } else
+      render_pass(queue, *device, cam, accum, params, adaptive, generic);
+    device->update_texture_pages();
+  }
+
+ private:
+  /// The scene mapped from a cache file, if any
+  scene_cache<scene_hittables> cache;
+  bool mapped = false;
+  /// The scene uploaded once for all the passes
+  std::optional<device_type> device;
+  /// The paths of the wavefront executor, allocated by the first pass
+  std::optional<wavefront::path_buffers> paths;
+};
+
+#endif
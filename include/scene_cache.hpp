@@ -0,0 +1,271 @@
+#ifndef RT_SYCL_SCENE_CACHE_HPP
+#define RT_SYCL_SCENE_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bvh.hpp"
+#include "hittable_list.hpp"
+#include "light.hpp"
+#include "material.hpp"
+#include "render.hpp"
+#include "scene_identity.hpp"
+#include "scene_loader.hpp"
+
+/** Binary scene files laid out like the device buffers
+
+    A scene cache stores what a device_scene uploads: the primitives of each
+    type already in BVH order with their BVH nodes, the materials, the decoded
+    texture bytes and the lights, along with the camera. The file is mapped in
+    memory and its sections are handed as is to the SYCL buffers, so loading
+    it does no parsing, no BVH build, no image decoding and no per-object
+    construction: the pages are only read when the buffers are uploaded.
+
+    The data is stored in the binary representation of the build that wrote
+    it, so a cache is only valid for builds with the same type sizes, which
+    are checked when opening it. The header also identifies the scene file it
+    was written from, by its absolute path, modification time and size, so
+    that a cache is only used for the same version of the same scene.
+*/
+template <typename HittableList> class scene_cache;
+
+template <typename... Primitives>
+class scene_cache<hittable_list<Primitives...>> {
+  static constexpr char magic[8] = { 'S', 'Y', 'R', 'T', 'S', 'C', 'N', '5' };
+
+  /// Materials, textures, lights, then the primitives and nodes of each type
+  static constexpr std::size_t nb_sections = 3 + 2 * sizeof...(Primitives);
+
+  /// Alignment of the sections in the file, mapped at a page boundary
+  static constexpr std::size_t alignment = 64;
+
+  struct section {
+    std::uint64_t offset;
+    std::uint64_t size;
+  };
+
+  struct header {
+    char magic[8];
+    /// Identify the binary layout of the stored types
+    std::uint64_t layout;
+    /// The scene file, whose path follows the header
+    scene_identity scene;
+    camera_parameters camera;
+    std::uint32_t nb_lights;
+    section sections[nb_sections];
+  };
+
+  /// Combine the sizes of the stored types, which change with the build
+  static constexpr std::uint64_t layout_key() {
+    std::uint64_t key = 14695981039346656037ull;
+    for (std::uint64_t size :
+         { sizeof(header), sizeof(material_t), sizeof(light_t),
+           sizeof(bvh_node), sizeof(Primitives)... })
+      key = (key ^ size) * 1099511628211ull;
+    return key;
+  }
+
+  /// Index of the primitive section of a type
+  template <typename Primitive>
+  static constexpr std::size_t primitive_section = []<std::size_t... I>(
+      std::index_sequence<I...>) {
+    std::size_t index = 0;
+    ((std::is_same_v<Primitive, Primitives> ? index = 3 + 2 * I : 0), ...);
+    return index;
+  }(std::index_sequence_for<Primitives...> {});
+
+  template <typename T> std::span<const T> get(std::size_t s) const {
+    const auto& sec = h->sections[s];
+    return { reinterpret_cast<const T*>(static_cast<const char*>(mapping) +
+                                        sec.offset),
+             sec.size / sizeof(T) };
+  }
+
+ public:
+  scene_cache() = default;
+  scene_cache(const scene_cache&) = delete;
+  scene_cache& operator=(const scene_cache&) = delete;
+
+  ~scene_cache() {
+    if (mapping)
+      munmap(mapping, mapping_size);
+  }
+
+  /** Tell whether a cache file can be used for a scene file, that is when it
+      was written from the same version of the same scene
+
+      \param[in] scene_file is nullptr for the built-in scene
+  */
+  static bool is_fresh(const char* cache_file, const char* scene_file) {
+    scene_identity expected;
+    std::string path;
+    if (!scene_identity::of(scene_file, expected, path))
+      return false;
+    header h;
+    std::ifstream in { cache_file, std::ios::binary };
+    return in.read(reinterpret_cast<char*>(&h), sizeof(h)) &&
+           std::memcmp(h.magic, magic, sizeof(magic)) == 0 &&
+           h.scene.matches(in, expected, path);
+  }
+
+  /// Map a cache file, returning false after printing an error if it
+  /// cannot be used
+  bool open(const char* file_name) {
+    const int fd = ::open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      std::cerr << "ERROR: Could not open scene cache '" << file_name << "'."
+                << std::endl;
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+    mapping_size = st.st_size;
+    mapping = mapping_size >= sizeof(header)
+                  ? mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0)
+                  : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      mapping = nullptr;
+      std::cerr << "ERROR: Could not map scene cache '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    h = static_cast<const header*>(mapping);
+    bool valid = std::memcmp(h->magic, magic, sizeof(magic)) == 0 &&
+                 h->layout == layout_key();
+    for (std::size_t s = 0; valid && s < nb_sections; ++s)
+      valid = h->sections[s].offset % alignment == 0 &&
+              h->sections[s].offset <= mapping_size &&
+              h->sections[s].size <= mapping_size - h->sections[s].offset;
+    if (!valid) {
+      std::cerr << "ERROR: '" << file_name
+                << "' is not a scene cache of this build." << std::endl;
+      munmap(mapping, mapping_size);
+      mapping = nullptr;
+      h = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  const camera_parameters& camera() const { return h->camera; }
+
+  /// The primitives of a type in BVH order, with their BVH
+  template <typename Primitive> bvh_ordered<Primitive> primitives() const {
+    constexpr auto s = primitive_section<Primitive>;
+    return { get<Primitive>(s), get<bvh_node>(s + 1) };
+  }
+
+  std::span<const material_t> host_materials() const {
+    return get<material_t>(0);
+  }
+
+  std::span<const std::uint8_t> host_textures() const {
+    return get<std::uint8_t>(1);
+  }
+
+  std::span<const light_t> host_lights() const { return get<light_t>(2); }
+
+  std::uint32_t light_count() const { return h->nb_lights; }
+
+  /// Number of primitives, without the padding of the empty types
+  std::size_t size() const {
+    return (0 + ... + [&] {
+      const auto p = primitives<Primitives>();
+      // An empty type has one padding primitive and a single empty leaf
+      return p.nodes.size() == 1 && p.nodes[0].count == 0 ? 0
+                                                          : p.primitives.size();
+    }());
+  }
+
+  /** Write the scene uploaded by a device_scene to a cache file
+
+      The file is written under a temporary name then renamed, so that a
+      concurrent run mapping the previous cache keeps reading it and an
+      interrupted write never leaves a partial cache.
+
+      \param[in] scene_file is the file the scene was loaded from, nullptr
+      for the built-in scene
+  */
+  static bool save(const char* file_name,
+                   const device_scene<Primitives...>& scene,
+                   const camera_parameters& cam, const char* scene_file) {
+    header h {};
+    std::string path;
+    if (!scene_identity::of(scene_file, h.scene, path)) {
+      std::cerr << "ERROR: Could not read scene file '" << scene_file
+                << "' to write its cache." << std::endl;
+      return false;
+    }
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.layout = layout_key();
+    h.camera = cam;
+    h.nb_lights = scene.light_count();
+    std::span<const std::byte> data[nb_sections] = {
+      std::as_bytes(scene.host_materials()),
+      std::as_bytes(scene.host_textures()),
+      std::as_bytes(scene.host_lights()),
+    };
+    (
+        [&] {
+          constexpr auto s = primitive_section<Primitives>;
+          const auto& p = scene.template primitives<Primitives>();
+          data[s] = std::as_bytes(p.primitives);
+          data[s + 1] = std::as_bytes(p.nodes);
+        }(),
+        ...);
+    auto align = [](std::uint64_t offset) {
+      return (offset + alignment - 1) / alignment * alignment;
+    };
+    std::uint64_t offset = align(sizeof(header) + path.size());
+    for (std::size_t s = 0; s < nb_sections; ++s) {
+      h.sections[s] = { offset, data[s].size() };
+      offset = align(offset + data[s].size());
+    }
+    const auto temporary =
+        std::string { file_name } + ".tmp" + std::to_string(getpid());
+    std::ofstream out { temporary, std::ios::binary };
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(path.data(), path.size());
+    const char padding[alignment] = {};
+    std::uint64_t position = sizeof(header) + path.size();
+    for (std::size_t s = 0; s < nb_sections; ++s) {
+      out.write(padding, h.sections[s].offset - position);
+      out.write(reinterpret_cast<const char*>(data[s].data()), data[s].size());
+      position = h.sections[s].offset + data[s].size();
+    }
+    out.close();
+    std::error_code ec;
+    if (out)
+      std::filesystem::rename(temporary, file_name, ec);
+    if (!out || ec) {
+      std::filesystem::remove(temporary, ec);
+      std::cerr << "ERROR: Could not write scene cache '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  void* mapping = nullptr;
+  std::size_t mapping_size = 0;
+  const header* h = nullptr;
+};
+
+#endif
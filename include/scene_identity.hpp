@@ -0,0 +1,62 @@
+#ifndef RT_SYCL_SCENE_IDENTITY_HPP
+#define RT_SYCL_SCENE_IDENTITY_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <string>
+#include <system_error>
+
+/** The version of a scene file a file derived from it was written for,
+    such as a scene cache or a checkpoint
+
+    It is stored in the header of the derived file, followed by the absolute
+    path of the scene file. The built-in scene has an empty path.
+*/
+struct scene_identity {
+  /// Modification time and size of the scene file
+  std::int64_t mtime;
+  std::uint64_t size;
+  std::uint64_t path_size;
+
+  /** Identify the current version of a scene file
+
+      \param[in] scene_file is nullptr for the built-in scene
+
+      \param[out] path is the absolute path of the scene file
+
+      \return false if the scene file cannot be read
+  */
+  static bool of(const char* scene_file, scene_identity& id,
+                 std::string& path) {
+    id = {};
+    path.clear();
+    if (!scene_file)
+      return true;
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(scene_file, ec);
+    if (ec)
+      return false;
+    id.mtime = mtime.time_since_epoch().count();
+    id.size = std::filesystem::file_size(scene_file, ec);
+    if (ec)
+      return false;
+    path = std::filesystem::absolute(scene_file, ec).string();
+    id.path_size = path.size();
+    return true;
+  }
+
+  /// Tell whether this identity, read from a header, and the path following
+  /// it in the file are those of an expected scene
+  bool matches(std::istream& in, const scene_identity& expected,
+               const std::string& path) const {
+    if (mtime != expected.mtime || size != expected.size ||
+        path_size != expected.path_size)
+      return false;
+    std::string stored_path(path_size, '\0');
+    return in.read(stored_path.data(), stored_path.size()) &&
+           stored_path == path;
+  }
+};
+
+#endif
@@ -0,0 +1,512 @@
+#ifndef RT_SYCL_SCENE_LOADER_HPP
+#define RT_SYCL_SCENE_LOADER_HPP
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "camera.hpp"
+#include "material.hpp"
+#include "render.hpp"
+#include "rtweekend.hpp"
+#include "texture.hpp"
+#include "vec.hpp"
+
+/** Text scene files
+
+    A scene file is read line by line, each line starting with a keyword
+    followed by its arguments separated by blanks, '#' starting a comment:
+
+    \code
+    camera [look_from x y z] [look_at x y z] [vup x y z] [vfov degrees]
+           [aperture a] [focus_dist d] [time t0 t1]
+    texture <name> solid r g b
+    texture <name> checker r g b r g b
+    texture <name> image <file> [frequency] [bc1]
+    material <name> lambertian <r g b | texture>
+    material <name> metal r g b fuzz
+    material <name> dielectric refraction_index r g b
+    material <name> light <r g b | texture>
+    material <name> isotropic <r g b | texture>
+    sphere cx cy cz radius <material>
+    moving_sphere cx0 cy0 cz0 cx1 cy1 cz1 t0 t1 radius <material>
+    xy_rect x0 x1 y0 y1 z <material>
+    xz_rect x0 x1 z0 z1 y <material>
+    yz_rect y0 y1 z0 z1 x <material>
+    triangle x0 y0 z0 x1 y1 z1 x2 y2 z2 <material>
+    box x0 y0 z0 x1 y1 z1 <material>
+    constant_medium density <material> sphere cx cy cz radius
+    constant_medium density <material> box x0 y0 z0 x1 y1 z1
+    grid_medium density <material> x0 y0 z0 x1 y1 z1 <file> nx ny nz
+    \endcode
+
+    Textures and materials are named to be shared and must be defined before
+    being used. The image files and the raw voxel files of the grid media,
+    see grid_medium, are relative to the directory of the scene file.
+
+    The file is read by large blocks and parsed in place, numbers with
+    std::from_chars and names looked up without building strings, so that
+    there is no allocation per token and a scene of a million spheres loads
+    in a fraction of a second.
+*/
+
+/// The camera of a scene, whose aspect ratio is given by the image size
+struct camera_parameters {
+  point look_from { 13, 3, 3 };
+  point look_at { 0, -1, 0 };
+  vec vup { 0, 1, 0 };
+  /// Vertical angle of view in degree
+  real_t vfov = 40;
+  /// Lens aperture, 0 for no depth of field
+  real_t aperture = 0.04f;
+  /// Focus distance, 0 to focus on look_at
+  real_t focus_dist = 0;
+  /// Shutter interval, for the moving objects
+  real_t time0 = 0;
+  real_t time1 = 1;
+
+  /// Turn the camera around look_at about vup, by an angle in degrees
+  void orbit(real_t degrees) {
+    const auto axis = unit_vector(vup);
+    const auto offset = look_from - look_at;
+    const auto angle = degrees_to_radians(degrees);
+    const auto c = sycl::cos(angle);
+    // Rodrigues' rotation formula
+    look_from = look_at + offset * c +
+                sycl::cross(axis, offset) * sycl::sin(angle) +
+                axis * sycl::dot(axis, offset) * (1 - c);
+  }
+
+  camera make_camera(real_t aspect_ratio) const {
+    return { look_from,
+             look_at,
+             vup,
+             vfov,
+             aspect_ratio,
+             aperture,
+             focus_dist > 0 ? focus_dist : length(look_at - look_from),
+             time0,
+             time1 };
+  }
+};
+
+namespace detail {
+
+/// Hash allowing to look up std::string keys with a std::string_view
+struct string_hash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view s) const {
+    return std::hash<std::string_view> {}(s);
+  }
+};
+
+template <typename T>
+using name_map =
+    std::unordered_map<std::string, T, string_hash, std::equal_to<>>;
+
+/// Parser of one scene file, reporting the first error
+class scene_parser {
+ public:
+  scene_parser(const char* file_name, scene_hittables& hittables,
+               material_table& materials, texture_table& images,
+               camera_parameters& cam)
+      : file_name { file_name }
+      , hittables { hittables }
+      , materials { materials }
+      , images { images }
+      , cam { cam } {}
+
+  bool parse() {
+    std::FILE* file = std::fopen(file_name, "rb");
+    if (!file) {
+      std::cerr << "ERROR: Could not open scene file '" << file_name << "'."
+                << std::endl;
+      return false;
+    }
+    // The lines are parsed in place from the block, an unfinished line
+    // being moved to its beginning before reading the next block
+    std::vector<char> block(1 << 20);
+    std::size_t kept = 0;
+    bool ok = true;
+    for (;;) {
+      if (kept == block.size())
+        block.resize(2 * block.size());
+      const auto read =
+          std::fread(block.data() + kept, 1, block.size() - kept, file);
+      const auto size = kept + read;
+      const bool last = read == 0;
+      const char* begin = block.data();
+      const char* end = begin + size;
+      for (;;) {
+        auto eol =
+            static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        if (!eol) {
+          if (!last || begin == end)
+            break;
+          // The last line has no end of line
+          eol = end;
+        }
+        ++line_number;
+        if (!parse_line({ begin, static_cast<std::size_t>(eol - begin) })) {
+          ok = false;
+          break;
+        }
+        begin = eol == end ? end : eol + 1;
+      }
+      if (!ok || last)
+        break;
+      kept = end - begin;
+      std::memmove(block.data(), begin, kept);
+    }
+    if (ok && std::ferror(file)) {
+      std::cerr << "ERROR: Could not read scene file '" << file_name << "'."
+                << std::endl;
+      ok = false;
+    }
+    std::fclose(file);
+    return ok;
+  }
+
+ private:
+  bool error(std::string_view message) {
+    std::cerr << "ERROR: " << file_name << ':' << line_number << ": "
+              << message;
+    if (!token_.empty())
+      std::cerr << " near '" << token_ << '\'';
+    std::cerr << std::endl;
+    return false;
+  }
+
+  static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  /// Read the next token of the line, empty at its end
+  std::string_view token() {
+    while (cursor != line_end && is_blank(*cursor))
+      ++cursor;
+    const char* start = cursor;
+    while (cursor != line_end && !is_blank(*cursor))
+      ++cursor;
+    token_ = { start, static_cast<std::size_t>(cursor - start) };
+    return token_;
+  }
+
+  /// Tell whether the next token is a number, without reading it
+  bool next_is_number() {
+    const char* saved = cursor;
+    const auto t = token();
+    cursor = saved;
+    real_t v;
+    const auto [end, ec] = std::from_chars(t.data(), t.data() + t.size(), v);
+    return !t.empty() && ec == std::errc {} && end == t.data() + t.size();
+  }
+
+  bool number(real_t& v) {
+    const auto t = token();
+    const auto [end, ec] = std::from_chars(t.data(), t.data() + t.size(), v);
+    if (t.empty() || ec != std::errc {} || end != t.data() + t.size())
+      return error("expected a number");
+    return true;
+  }
+
+  bool vector(vec& v) {
+    real_t x, y, z;
+    if (!number(x) || !number(y) || !number(z))
+      return false;
+    v = { x, y, z };
+    return true;
+  }
+
+  bool material(material_id& id) {
+    const auto it = material_ids.find(token());
+    if (it == material_ids.end())
+      return error("unknown material");
+    id = it->second;
+    return true;
+  }
+
+  /// Read either a color or the name of a texture
+  bool color_or_texture(texture_t& t) {
+    if (next_is_number()) {
+      color c;
+      if (!vector(c))
+        return false;
+      t = solid_texture { c };
+      return true;
+    }
+    const auto it = textures.find(token());
+    if (it == textures.end())
+      return error("unknown texture");
+    t = it->second;
+    return true;
+  }
+
+  bool parse_camera() {
+    for (auto key = token(); !key.empty(); key = token()) {
+      bool ok;
+      if (key == "look_from")
+        ok = vector(cam.look_from);
+      else if (key == "look_at")
+        ok = vector(cam.look_at);
+      else if (key == "vup")
+        ok = vector(cam.vup);
+      else if (key == "vfov")
+        ok = number(cam.vfov);
+      else if (key == "aperture")
+        ok = number(cam.aperture);
+      else if (key == "focus_dist")
+        ok = number(cam.focus_dist);
+      else if (key == "time")
+        ok = number(cam.time0) && number(cam.time1);
+      else
+        return error("unknown camera parameter");
+      if (!ok)
+        return false;
+    }
+    return true;
+  }
+
+  bool parse_texture() {
+    const std::string name { token() };
+    if (name.empty())
+      return error("expected a texture name");
+    const auto kind = token();
+    texture_t t;
+    if (kind == "solid") {
+      color c;
+      if (!vector(c))
+        return false;
+      t = solid_texture { c };
+    } else if (kind == "checker") {
+      color c1, c2;
+      if (!vector(c1) || !vector(c2))
+        return false;
+      t = checker_texture { c1, c2 };
+    } else if (kind == "image") {
+      const auto path = std::filesystem::path { file_name }.parent_path() /
+                        std::filesystem::path { token() };
+      real_t frequency = 1;
+      if (next_is_number() && !number(frequency))
+        return false;
+      auto texel_format = image_texture::format::rgb8;
+      const char* saved = cursor;
+      if (token() == "bc1")
+        texel_format = image_texture::format::bc1;
+      else
+        cursor = saved;
+      t = images.add_image(path.string().c_str(), frequency, texel_format);
+    } else
+      return error("unknown texture type");
+    textures.insert_or_assign(name, t);
+    return true;
+  }
+
+  bool parse_material() {
+    const std::string name { token() };
+    if (name.empty())
+      return error("expected a material name");
+    const auto kind = token();
+    material_t m;
+    texture_t t;
+    color c;
+    real_t v;
+    if (kind == "lambertian") {
+      if (!color_or_texture(t))
+        return false;
+      m = lambertian_material { t };
+    } else if (kind == "metal") {
+      if (!vector(c) || !number(v))
+        return false;
+      m = metal_material { c, v };
+    } else if (kind == "dielectric") {
+      if (!number(v) || !vector(c))
+        return false;
+      m = dielectric_material { v, c };
+    } else if (kind == "light") {
+      if (!color_or_texture(t))
+        return false;
+      m = lightsource_material { t };
+    } else if (kind == "isotropic") {
+      if (!color_or_texture(t))
+        return false;
+      m = isotropic_material { t };
+    } else
+      return error("unknown material type");
+    material_ids.insert_or_assign(name, materials.add(m));
+    return true;
+  }
+
+  /// Read the numbers of a primitive followed by its material
+  template <std::size_t N> bool numbers_and_material(real_t (&v)[N],
+                                                     material_id& id) {
+    for (auto& x : v)
+      if (!number(x))
+        return false;
+    return material(id);
+  }
+
+  bool parse_medium() {
+    real_t density;
+    material_id phase = 0;
+    if (!number(density) || !material(phase))
+      return false;
+    if (!(density > 0))
+      return error("the density must be positive");
+    const auto shape = token();
+    real_t v[6];
+    if (shape == "sphere") {
+      for (int i = 0; i < 4; ++i)
+        if (!number(v[i]))
+          return false;
+      hittables.add(constant_medium {
+          sphere { point { v[0], v[1], v[2] }, v[3], phase }, density,
+          phase });
+    } else if (shape == "box") {
+      for (auto& x : v)
+        if (!number(x))
+          return false;
+      hittables.add(constant_medium {
+          box { point { v[0], v[1], v[2] }, point { v[3], v[4], v[5] }, phase },
+          density, phase });
+    } else
+      return error("unknown medium boundary");
+    return true;
+  }
+
+  /// Read a positive integer
+  bool count(std::uint32_t& n) {
+    const auto t = token();
+    const auto [end, ec] = std::from_chars(t.data(), t.data() + t.size(), n);
+    if (t.empty() || ec != std::errc {} || end != t.data() + t.size() || !n)
+      return error("expected a positive integer");
+    return true;
+  }
+
+  bool parse_grid_medium() {
+    real_t density;
+    material_id phase = 0;
+    point p0, p1;
+    if (!number(density) || !material(phase) || !vector(p0) || !vector(p1))
+      return false;
+    if (!(density > 0))
+      return error("the density must be positive");
+    if (!(p0.x() < p1.x() && p0.y() < p1.y() && p0.z() < p1.z()))
+      return error("the box of the grid must not be empty");
+    const auto path = std::filesystem::path { file_name }.parent_path() /
+                      std::filesystem::path { token() };
+    std::uint32_t nx, ny, nz;
+    if (!count(nx) || !count(ny) || !count(nz))
+      return false;
+    std::vector<std::uint8_t> voxels;
+    if (!grid_medium::read_voxels(path.string().c_str(),
+                                  std::size_t { nx } * ny * nz, voxels))
+      return error("cannot read the voxels");
+    hittables.add(grid_medium { aabb { p0, p1 }, density, nx, ny, nz, voxels,
+                                images, phase });
+    return true;
+  }
+
+  bool parse_line(std::string_view line) {
+    cursor = line.data();
+    line_end = line.data() + line.size();
+    if (const auto comment = line.find('#'); comment != line.npos)
+      line_end = line.data() + comment;
+    const auto keyword = token();
+    if (keyword.empty())
+      return true;
+    material_id id = 0;
+    bool ok;
+    if (keyword == "sphere") {
+      real_t v[4];
+      ok = numbers_and_material(v, id);
+      if (ok)
+        hittables.add(sphere { point { v[0], v[1], v[2] }, v[3], id });
+    } else if (keyword == "moving_sphere") {
+      real_t v[9];
+      ok = numbers_and_material(v, id);
+      if (ok)
+        hittables.add(sphere { point { v[0], v[1], v[2] },
+                               point { v[3], v[4], v[5] }, v[6], v[7], v[8],
+                               id });
+    } else if (keyword == "triangle") {
+      real_t v[9];
+      ok = numbers_and_material(v, id);
+      if (ok)
+        hittables.add(triangle { point { v[0], v[1], v[2] },
+                                 point { v[3], v[4], v[5] },
+                                 point { v[6], v[7], v[8] }, id });
+    } else if (keyword == "xy_rect" || keyword == "xz_rect" ||
+               keyword == "yz_rect") {
+      real_t v[5];
+      ok = numbers_and_material(v, id);
+      if (ok && keyword == "xy_rect")
+        hittables.add(xy_rect { v[0], v[1], v[2], v[3], v[4], id });
+      else if (ok && keyword == "xz_rect")
+        hittables.add(xz_rect { v[0], v[1], v[2], v[3], v[4], id });
+      else if (ok)
+        hittables.add(yz_rect { v[0], v[1], v[2], v[3], v[4], id });
+    } else if (keyword == "box") {
+      real_t v[6];
+      ok = numbers_and_material(v, id);
+      if (ok)
+        hittables.add(box { point { v[0], v[1], v[2] },
+                            point { v[3], v[4], v[5] }, id });
+    } else if (keyword == "constant_medium")
+      ok = parse_medium();
+    else if (keyword == "grid_medium")
+      ok = parse_grid_medium();
+    else if (keyword == "material")
+      ok = parse_material();
+    else if (keyword == "texture")
+      ok = parse_texture();
+    else if (keyword == "camera")
+      ok = parse_camera();
+    else
+      return error("unknown keyword");
+    if (ok && !token().empty())
+      return error("unexpected argument");
+    return ok;
+  }
+
+  const char* file_name;
+  scene_hittables& hittables;
+  material_table& materials;
+  /// Where the image textures and the voxels are stored
+  texture_table& images;
+  camera_parameters& cam;
+  name_map<material_id> material_ids;
+  name_map<texture_t> textures;
+  std::size_t line_number = 0;
+  /// Position in the current line
+  const char* cursor = nullptr;
+  const char* line_end = nullptr;
+  /// Last token read, for the error messages
+  std::string_view token_;
+};
+
+} // namespace detail
+
+/** Add the content of a scene file to a scene
+
+    \param[out] cam is only changed by the camera lines of the file
+
+    \return false after printing the error if the file cannot be read or is
+    invalid
+*/
+inline bool load_scene(const char* file_name, scene_hittables& hittables,
+                       material_table& materials, texture_table& images,
+                       camera_parameters& cam) {
+  return detail::scene_parser { file_name, hittables, materials, images, cam }
+      .parse();
+}
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+#include "aabb.hpp"
 #include "material.hpp"
 #include "ray.hpp"
+#include "ray_packet.hpp"
 #include "rtweekend.hpp"
 #include "texture.hpp"
 #include "vec.hpp"
@@ -27,24 +29,24 @@ class sphere {
  public:
   sphere() = default;
 
-  sphere(const point& cen, real_t r, const material_t& mat_type)
+  sphere(const point& cen, real_t r, material_id mat)
       : center0 { cen }
       , center1 { cen }
       , radius { r }
       , time0 { 0 }
       , time1 { 0 }
-      , material_type { mat_type } {}
+      , material { mat } {}
 
   /// Simulates moving spheres from center0 to
   /// center1 between time0 and time1
   sphere(const point& cen0, const point& cen1, real_t _time0, real_t _time1,
-         real_t r, const material_t& mat_type)
+         real_t r, material_id mat)
       : center0 { cen0 }
       , center1 { cen1 }
       , radius { r }
       , time0 { _time0 }
       , time1 { _time1 }
-      , material_type { mat_type } {}
+      , material { mat } {}
 
   /// Computes center of the sphere based on
   /// the time information stored in the ray
@@ -55,11 +57,53 @@ class sphere {
       return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
   }
 
-  /// Compute ray interaction with sphere
-  bool hit(auto&, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
-    hit_material_type = material_type;
+  /// Bounding box of the sphere over its whole motion
+  aabb bounding_box() const {
+    const vec r { radius, radius, radius };
+    return surrounding_box({ center0 - r, center0 + r },
+                           { center1 - r, center1 + r });
+  }
+
+  /** Bounding box of the sphere during a shutter interval, such as the one
+      of a frame of an animation, which can be outside of [time0, time1]
+      since the motion goes on at the same speed
+  */
+  aabb bounding_box(real_t t0, real_t t1) const {
+    if (time0 == time1)
+      return bounding_box();
+    const vec r { radius, radius, radius };
+    return surrounding_box({ center(t0) - r, center(t0) + r },
+                           { center(t1) - r, center(t1) + r });
+  }
+
+  /// u goes around the equator and v from pole to pole
+  void set_uv_rates(hit_record& rec) const {
+    rec.du = 1 / (2 * pi * radius);
+    rec.dv = 1 / (pi * radius);
+  }
+
+  /** Distances along the line of a ray where it is inside the sphere, in
+      one pass
 
+      \return false if the line misses the sphere
+  */
+  bool interval(const ray& r, real_t& t_enter, real_t& t_exit) const {
+    const vec oc = r.origin() - center(r.time());
+    const auto a = sycl::dot(r.direction(), r.direction());
+    const auto b = sycl::dot(oc, r.direction());
+    const auto c = sycl::dot(oc, oc) - radius * radius;
+    const auto discriminant = b * b - a * c;
+    if (!(discriminant > 0))
+      return false;
+    const auto root = sycl::sqrt(discriminant);
+    t_enter = (-b - root) / a;
+    t_exit = (-b + root) / a;
+    return true;
+  }
+
+  /// Compute ray interaction with sphere
+  bool hit(auto&, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
     /*(P(t)-C).(P(t)-C)=r^2
     in the above sphere equation P(t) is the point on sphere hit by the ray
     (A+tb−C)⋅(A+tb−C)=r^2
@@ -86,6 +130,8 @@ class sphere {
         point is calculated as above. This vector is used to also
         used to get the mercator coordinates of the hitpoint.*/
         std::tie(rec.u, rec.v) = mercator_coordinates(rec.normal);
+        set_uv_rates(rec);
+        rec.material = material;
         return true;
       }
       // Second root
@@ -98,6 +144,8 @@ class sphere {
         rec.set_face_normal(r, outward_normal);
         // Update u and v values in the hit record
         std::tie(rec.u, rec.v) = mercator_coordinates(rec.normal);
+        set_uv_rates(rec);
+        rec.material = material;
         return true;
       }
     }
@@ -105,6 +153,39 @@ class sphere {
     return false;
   }
 
+  /** Intersect a packet of rays with the sphere
+
+      Branch-free version of the distance computation of hit, so that the
+      loop over the rays is vectorized.
+
+      \param[out] t is the hit distance of each ray between min and its max,
+      or infinity if it misses
+  */
+  template <std::size_t N>
+  void hit_packet(const ray_packet<N>& r, real_t min,
+                  const typename ray_packet<N>::lanes& max,
+                  typename ray_packet<N>::lanes& t) const {
+    const auto motion = center1 - center0;
+    const auto moving = time0 != time1;
+    for (std::size_t i = 0; i < N; ++i) {
+      const auto f = moving ? (r.time[i] - time0) / (time1 - time0) : 0.0f;
+      const auto ocx = r.ox[i] - (center0.x() + f * motion.x());
+      const auto ocy = r.oy[i] - (center0.y() + f * motion.y());
+      const auto ocz = r.oz[i] - (center0.z() + f * motion.z());
+      const auto a = r.dx[i] * r.dx[i] + r.dy[i] * r.dy[i] + r.dz[i] * r.dz[i];
+      const auto b = ocx * r.dx[i] + ocy * r.dy[i] + ocz * r.dz[i];
+      const auto c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+      const auto discriminant = b * b - a * c;
+      const auto root = sycl::sqrt(sycl::fmax(discriminant, 0.0f));
+      const auto t0 = (-b - root) / a;
+      const auto t1 = (-b + root) / a;
+      const auto t0_ok = t0 < max[i] && t0 > min;
+      const auto t1_ok = t1 < max[i] && t1 > min;
+      t[i] = discriminant > 0 ? (t0_ok ? t0 : (t1_ok ? t1 : infinity))
+                              : infinity;
+    }
+  }
+
   // Geometry properties
   point center0, center1;
   real_t radius;
@@ -112,8 +193,8 @@ class sphere {
   // Time of start and end of motion of the sphere
   real_t time0, time1;
 
-  // Material properties
-  material_t material_type;
+  // Index of the material in the scene material table
+  material_id material;
 };
 
 #endif
@@ -1,14 +1,33 @@
 #ifndef RT_SYCL_TEXTURE_HPP
 #define RT_SYCL_TEXTURE_HPP
+#include "block_compression.hpp"
 #include "hitable.hpp"
 #include "rtweekend.hpp"
+#include "texture_store.hpp"
 #include "vec.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
 #include <vector>
 
+#include <unistd.h>
+
 #include "sycl.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -24,6 +43,9 @@ struct solid_texture {
   // For solid texture, the color is same throughout the sphere
   color value(auto&, const hit_record&) const { return color_value; }
 
+  /// Fields identifying the texture, used to share identical materials
+  auto fields() const { return std::tie(color_value); }
+
  private:
   color color_value;
 };
@@ -47,6 +69,9 @@ struct checker_texture {
     else
       return even.value(ctx, rec);
   }
+
+  auto fields() const { return std::tie(odd, even); }
+
   solid_texture odd;
   solid_texture even;
 };
@@ -55,105 +80,696 @@ struct checker_texture {
   @brief A texture based on an image
 
   In order to be able to get the bitmap on the device without embedding it in
-  the object, all image_texture textures are serialized in one vector.
+  the object, all the image_texture textures of a scene are serialized in one
+  vector owned by its texture_table.
 
   The offset of the texture in the vector is stored in the image_texture
   instance.
 
-  When all the textures have been loaded, the freeze() method can be called to
-  get a sycl::buffer that store this data.
+  Each image is stored with its mip-map pyramid, each level halving the size
+  of the previous one down to 1x1, so that surfaces seen from far away are
+  filtered instead of aliased. The level is chosen from the footprint of the
+  ray at the hit point and interpolated bilinearly, or trilinearly between 2
+  levels when the image is minified.
 
+  The texels of each level are stored by square tiles of tile_size x
+  tile_size texels, the rows of a tile being contiguous, so that the 4
+  texels of a bilinear lookup are usually in the same cache lines whatever
+  the direction of the access.
+
+  A texture can also be stored in the BC1 format, each tile being compressed
+  to 8 bytes instead of 48 when the image is loaded, for 6 times less memory
+  and bandwidth at the cost of some color accuracy. The texels are then
+  decoded from their tile on each lookup.
+
+  With a texture store enabled, the large images are streamed: only the
+  coarse levels fitting in a page stay in the vector, the finer ones being
+  read from the cache file by pages on demand, see texture_store.hpp.
  */
 struct image_texture {
+  /// Storage of the texels
+  enum class format : std::uint32_t {
+    /// 3 bytes per texel
+    rgb8,
+    /// BC1 blocks of 8 bytes per tile, see block_compression.hpp
+    bc1
+  };
+
  private:
+  friend class texture_table;
+
   static constexpr auto bytes_per_pixel = 3;
-  // Vector in which all the textures are serialized
-  static std::vector<uint8_t> texture_data;
-  static bool frozen;
+  /// Side of the tiles of texels, 4 x 4 RGB texels taking 48 bytes
+  static constexpr std::size_t tile_size = 4;
 
   std::size_t width {};
   std::size_t height {};
-  // offset of the first pixel in the texture vector
+  // offset of the first resident byte in the texture vector
   std::size_t offset;
 
+  /// Bytes of the levels in pages from first_page of the texture store, 0
+  /// if the whole pyramid is in the texture vector
+  std::size_t paged_size {};
+  std::uint32_t first_page { texture_store::not_resident };
+
   /// The repetition rate of the image
   float cyclic_frequency { 1.f };
 
+  /// Number of levels of the mip-map pyramid
+  std::uint32_t nb_levels { 1 };
+
+  format texel_format { format::rgb8 };
+
   image_texture(std::size_t _width, std::size_t _height, std::size_t _offset,
-                float _cyclic_frequency)
+                float _cyclic_frequency, std::uint32_t _nb_levels,
+                format _texel_format)
       : width { _width }
       , height { _height }
       , offset { _offset }
-      , cyclic_frequency { _cyclic_frequency } {}
+      , cyclic_frequency { _cyclic_frequency }
+      , nb_levels { _nb_levels }
+      , texel_format { _texel_format } {}
+
+  static std::size_t padded(std::size_t size) {
+    return (size + tile_size - 1) / tile_size * tile_size;
+  }
+
+  /// Index of texel (x, y) in a level of padded width w
+  static std::size_t tiled_index(std::size_t w, std::size_t x, std::size_t y) {
+    return ((y / tile_size) * (w / tile_size) + x / tile_size) * tile_size *
+               tile_size +
+           (y % tile_size) * tile_size + x % tile_size;
+  }
+
+  /// Size in bytes of a w x h level
+  static std::size_t level_size(format f, std::size_t w, std::size_t h) {
+    const auto texels = padded(w) * padded(h);
+    return f == format::bc1
+               ? texels / (tile_size * tile_size) * bc1::block_size
+               : texels * bytes_per_pixel;
+  }
+
+  /// Number of levels of the mip-map pyramid of a w x h image
+  static std::uint32_t level_count(std::size_t w, std::size_t h) {
+    std::uint32_t levels = 1;
+    for (; w > 1 || h > 1; ++levels) {
+      w = std::max<std::size_t>(w / 2, 1);
+      h = std::max<std::size_t>(h / 2, 1);
+    }
+    return levels;
+  }
 
  public:
+  /// Get the color for the texture at the given place
+  /// \todo rename this value() to color() everywhere?
+  color value(auto& ctx, const hit_record& rec) const {
+    // The image is repeated by the repetition factor
+    const auto s = rec.u * cyclic_frequency;
+    // The image frame buffer is going downwards, so flip the y axis
+    const auto t = 1 - rec.v * cyclic_frequency;
+    // Number of texels of the finest level covered by the ray footprint
+    const auto texels = rec.footprint * cyclic_frequency *
+                        sycl::fmax(rec.du * width, rec.dv * height);
+    const auto lod =
+        texels > 1 ? sycl::fmin(sycl::log2(texels),
+                                static_cast<real_t>(nb_levels - 1))
+                   : 0.0f;
+    const auto level = static_cast<std::uint32_t>(lod);
+    const auto blend = lod - level;
+    // Offset of the level in the pyramid and size of the level
+    std::size_t level_offset = 0;
+    auto w = width, h = height;
+    auto next_level = [&] {
+      level_offset += level_size(texel_format, w, h);
+      w = sycl::max<std::size_t>(w / 2, 1);
+      h = sycl::max<std::size_t>(h / 2, 1);
+    };
+    for (std::uint32_t l = 0; l < level; ++l)
+      next_level();
+    bool missed = false;
+    auto c = sample(ctx, level_offset, w, h, s, t, missed);
+    if (blend > 0) {
+      next_level();
+      c = (1 - blend) * c + blend * sample(ctx, level_offset, w, h, s, t,
+                                           missed);
+    }
+    if (missed) {
+      // Use the finest level in memory until the pages are loaded
+      while (level_offset < paged_size)
+        next_level();
+      c = sample(ctx, level_offset, w, h, s, t, missed);
+    }
+    return c;
+  }
+
+  auto fields() const {
+    return std::tie(width, height, offset, cyclic_frequency, nb_levels,
+                    texel_format, paged_size, first_page);
+  }
+
+ private:
+  /** Interpolate the level at an offset of the pyramid, either in memory or
+      in the pages of the texture store
+
+      \param[out] missed is set if a page is not resident, the result being
+      then wrong
+  */
+  color sample(auto& ctx, std::size_t level_offset, std::size_t w,
+               std::size_t h, real_t s, real_t t, bool& missed) const {
+    if (level_offset >= paged_size)
+      return bilinear(
+          [&](std::size_t i) -> const uint8_t* {
+            return &ctx.texture_data[offset + level_offset - paged_size + i];
+          },
+          texel_format, w, h, s, t);
+    return bilinear(
+        [&](std::size_t i) -> const uint8_t* {
+          const auto address = level_offset + i;
+          const auto page = first_page + address / texture_store::page_size;
+          sycl::atomic_ref<std::uint32_t, sycl::memory_order::relaxed,
+                           sycl::memory_scope::device,
+                           sycl::access::address_space::global_space>
+              usage { ctx.texture_pages.usage[page] };
+          if (!usage.load())
+            usage.store(1);
+          const auto slot = ctx.texture_pages.table[page];
+          if (slot == texture_store::not_resident) {
+            missed = true;
+            return &ctx.texture_data[0];
+          }
+          return &ctx.texture_pages.pool[slot * texture_store::page_size +
+                                         address % texture_store::page_size];
+        },
+        texel_format, w, h, s, t);
+  }
+
+  /** Bilinear interpolation of a level of size w x h at (s, t), repeated
+      outside of [0, 1)
+
+      \param[in] fetch gives the address of a byte of the level
+  */
+  static color bilinear(auto&& fetch, format f, std::size_t w, std::size_t h,
+                        real_t s, real_t t) {
+    // The texel centers are at half-integer coordinates
+    const auto x = (s - sycl::floor(s)) * w - 0.5f;
+    const auto y = (t - sycl::floor(t)) * h - 0.5f;
+    const auto fx = sycl::floor(x);
+    const auto fy = sycl::floor(y);
+    const auto ax = x - fx;
+    const auto ay = y - fy;
+    // x and y are in [-0.5, size - 0.5), so the floors are in [-1, size)
+    const std::size_t x0 = fx < 0 ? w - 1 : static_cast<std::size_t>(fx);
+    const std::size_t y0 = fy < 0 ? h - 1 : static_cast<std::size_t>(fy);
+    const std::size_t x1 = x0 + 1 == w ? 0 : x0 + 1;
+    const std::size_t y1 = y0 + 1 == h ? 0 : y0 + 1;
+    const auto pw = padded(w);
+    auto texel = [&](std::size_t i, std::size_t j) {
+      const auto tiled = tiled_index(pw, i, j);
+      if (f == format::bc1) {
+        constexpr auto texels_per_tile = tile_size * tile_size;
+        return bc1::decode(fetch(tiled / texels_per_tile * bc1::block_size),
+                           0, tiled % texels_per_tile);
+      }
+      const auto* texel = fetch(tiled * bytes_per_pixel);
+      return color { static_cast<real_t>(texel[0]),
+                     static_cast<real_t>(texel[1]),
+                     static_cast<real_t>(texel[2]) };
+    };
+    const auto top = (1 - ax) * texel(x0, y0) + ax * texel(x1, y0);
+    const auto bottom = (1 - ax) * texel(x0, y1) + ax * texel(x1, y1);
+    return ((1 - ay) * top + ay * bottom) * (1.f / 255);
+  }
+};
+
+using texture_t = std::variant<checker_texture, solid_texture, image_texture>;
+
+/** The image textures of a scene and the storage of their texels
+
+    add_image() only reads the size of the image to reserve its place in the
+    texture vector, which is allocated once for all the images. The images
+    are decoded and mip-mapped concurrently by a pool of threads when
+    freezing, each one writing its own part of the vector. If a cache
+    directory is set, the texels of each image are also written there and
+    read back by the later runs instead of decoding the image again, as long
+    as the image file keeps the same modification time.
+
+    Other data read by the kernels, such as the voxels of a grid_medium, can
+    also be stored in the vector with add_data().
+
+    Each scene has its own table, so several scenes can be loaded, rendered
+    and destroyed independently in the same process.
+*/
+class texture_table {
+ public:
+  using format = image_texture::format;
+
+  texture_table() = default;
+  texture_table(const texture_table&) = delete;
+  texture_table& operator=(const texture_table&) = delete;
+
   /** Create a texture from an image file
 
+         The image is only decoded by freeze() or freeze_data(), an image
+         file used by several textures being loaded once.
+
          \param[in] file_name is the path name to the image file
 
          \param[in] cyclic_frequency is an optional repetition rate of
          the image in the texture
+
+         \param[in] texel_format selects how the texels are stored
  */
-  static image_texture image_texture_factory(const char* file_name,
-                                             float _cyclic_frequency = 1) {
+  image_texture add_image(const char* file_name, float _cyclic_frequency = 1,
+                          format _texel_format = format::rgb8) {
     assert(!frozen);
-    auto components_per_pixel = bytes_per_pixel;
-    uint8_t* _data;
-    int _w, _h;
-    _data =
-        stbi_load(file_name, &_w, &_h, &components_per_pixel, bytes_per_pixel);
-    std::size_t _offset = 0;
-    if (!_data) {
+    for (const auto& p : pending)
+      if (p.file_name == file_name && p.texel_format == _texel_format)
+        return make_texture(p, _cyclic_frequency);
+    int _w, _h, components_per_pixel;
+    if (!stbi_info(file_name, &_w, &_h, &components_per_pixel)) {
       std::cerr << "ERROR: Could not load texture image file '" << file_name
                 << "'.\n"
                 << stbi_failure_reason() << std::endl;
-      _w = _h = 1;
-    } else {
-      auto size = bytes_per_pixel * _w * _h;
-      _offset = texture_data.size() / 3;
-      std::copy(_data, _data + size, std::back_inserter(texture_data));
+      // The fallback texel at offset 0
+      return image_texture(1, 1, 0, _cyclic_frequency, 1, format::rgb8);
+    }
+    const std::size_t w = _w, h = _h;
+    pending_image p { file_name,       w, h, _texel_format,
+                      reserved, 0, texture_store::not_resident };
+    if (store.enabled() && !cache_directory.empty()) {
+      // Stream the levels before the ones fitting in a page
+      std::size_t tail_size = pyramid_size(_texel_format, w, h);
+      for (std::size_t lw = w, lh = h;
+           tail_size > texture_store::page_size;) {
+        p.paged_size += image_texture::level_size(_texel_format, lw, lh);
+        tail_size -= image_texture::level_size(_texel_format, lw, lh);
+        lw = std::max<std::size_t>(lw / 2, 1);
+        lh = std::max<std::size_t>(lh / 2, 1);
+      }
+      if (p.paged_size)
+        p.first_page = store.reserve(p.paged_size);
     }
-    return image_texture(_w, _h, _offset, _cyclic_frequency);
+    reserved += pyramid_size(_texel_format, w, h) - p.paged_size;
+    pending.push_back(p);
+    return make_texture(p, _cyclic_frequency);
+  }
+
+  /** Stream the large images through a pool of pages of a bounded size
+
+      The images are only streamed from the cache directory, which must be
+      set too. Must be called before creating the textures.
+  */
+  void set_pool_size(std::size_t bytes) {
+    assert(pending.empty());
+    store.set_pool_size(bytes / texture_store::page_size);
+  }
+
+  texture_store& page_store() { return store; }
+
+  /** Store other data with the texels, such as the voxels of a
+      grid_medium, to be read on the device through the texture data
+
+      \return the offset of the data in the texture data
+  */
+  std::size_t add_data(std::vector<uint8_t> bytes) {
+    assert(!frozen);
+    const auto offset = reserved;
+    reserved += bytes.size();
+    blocks.push_back({ offset, std::move(bytes) });
+    return offset;
+  }
+
+  /** Cache the decoded images in a directory, created if needed
+
+      \return false after printing an error if the directory cannot be used
+  */
+  bool set_cache_directory(const char* directory) {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec) {
+      std::cerr << "ERROR: Could not create texture cache directory '"
+                << directory << "'.\n"
+                << ec.message() << std::endl;
+      return false;
+    }
+    cache_directory = directory;
+    return true;
   }
 
   /**
     @brief Get a sycl::buffer containing texture data.
 
-    image_texture_factory should not be called after having called freeze
+    add_image should not be called after having called freeze
 
     @return sycl::buffer<uint8_t, 2>
    */
-  static sycl::buffer<uint8_t, 2> freeze() {
+  sycl::buffer<uint8_t, 2> freeze() {
+    const auto data = freeze_data();
+    return sycl::buffer<uint8_t, 2> { data.data(), { data.size() / 3, 3 } };
+  }
+
+  /// Like freeze(), but get the texture data itself, for example to save it
+  std::span<const uint8_t> freeze_data() {
     assert(!frozen);
+    load_pending();
     frozen = true;
-    return sycl::buffer<uint8_t, 2> { texture_data.data(),
-                                      { texture_data.size() / 3, 3 } };
+    return texture_data;
   }
 
-  /// Get the color for the texture at the given place
-  /// \todo rename this value() to color() everywhere?
-  color value(auto& ctx, const hit_record& rec) const {
-    // If texture data is unavailable, return solid cyan
-    // The image is repeated by the repetition factor
+ private:
+  static constexpr auto bytes_per_pixel = image_texture::bytes_per_pixel;
+  static constexpr auto tile_size = image_texture::tile_size;
 
-    std::size_t i =
-        sycl::fmod(rec.u * cyclic_frequency, (float)1) * (width - 1);
-    // The image frame buffer is going downwards, so flip the y axis
-    std::size_t j =
-        (1 - sycl::fmod(rec.v * cyclic_frequency, (float)1)) * (height - 1);
-    std::size_t local_offset = j * width + i;
-    std::size_t pix_idx = local_offset + offset;
-    auto scale = 1.f / 255;
-    auto& texture_data = ctx.texture_data;
-    return { texture_data[pix_idx * 3] * scale,
-             texture_data[pix_idx * 3 + 1] * scale,
-             texture_data[pix_idx * 3 + 2] * scale };
+  /// An image whose place is reserved in texture_data, loaded when freezing
+  struct pending_image {
+    std::string file_name;
+    std::size_t width;
+    std::size_t height;
+    format texel_format;
+    /// Offset of the first resident byte in texture_data
+    std::size_t offset;
+    /// Bytes of the streamed levels, which are not in texture_data
+    std::size_t paged_size;
+    std::uint32_t first_page;
+  };
+  std::vector<pending_image> pending;
+
+  /// Data added by add_data, copied to its offset when freezing
+  struct data_block {
+    std::size_t offset;
+    std::vector<uint8_t> bytes;
+  };
+  std::vector<data_block> blocks;
+
+  /// Where to cache the decoded images, empty if they are not cached
+  std::filesystem::path cache_directory;
+
+  /// The pages of the streamed images
+  texture_store store;
+
+  /// Vector in which all the textures are serialized, starting with the
+  /// fallback texel (solid blue) used when an image cannot be loaded
+  std::vector<uint8_t> texture_data { 0, 0, 1 };
+  /// Number of bytes of texture_data once the pending images and data are
+  /// stored
+  std::size_t reserved = texture_data.size();
+  bool frozen = false;
+
+  static image_texture make_texture(const pending_image& p,
+                                    float _cyclic_frequency) {
+    image_texture t { p.width,
+                      p.height,
+                      p.offset,
+                      _cyclic_frequency,
+                      image_texture::level_count(p.width, p.height),
+                      p.texel_format };
+    t.paged_size = p.paged_size;
+    t.first_page = p.first_page;
+    return t;
   }
-};
 
-using texture_t = std::variant<checker_texture, solid_texture, image_texture>;
+  /// Write a w x h RGB image in the tiled layout, returning the end of the
+  /// level
+  static uint8_t* write_tiled(const std::vector<uint8_t>& image, std::size_t w,
+                              std::size_t h, uint8_t* out) {
+    const auto pw = image_texture::padded(w);
+    for (std::size_t y = 0; y < h; ++y)
+      for (std::size_t x = 0; x < w; ++x)
+        std::copy_n(&image[(y * w + x) * bytes_per_pixel], bytes_per_pixel,
+                    &out[image_texture::tiled_index(pw, x, y) *
+                         bytes_per_pixel]);
+    return out + pw * image_texture::padded(h) * bytes_per_pixel;
+  }
+
+  /// Compress a w x h RGB image to BC1 blocks in the tiled order, the
+  /// texels outside of the image repeating its last row and column, and
+  /// return the end of the level
+  static uint8_t* write_bc1(const std::vector<uint8_t>& image, std::size_t w,
+                            std::size_t h, uint8_t* out) {
+    for (std::size_t by = 0; by < h; by += tile_size)
+      for (std::size_t bx = 0; bx < w; bx += tile_size) {
+        float texels[tile_size * tile_size][3];
+        for (std::size_t j = 0; j < tile_size; ++j)
+          for (std::size_t i = 0; i < tile_size; ++i) {
+            const auto x = std::min(bx + i, w - 1);
+            const auto y = std::min(by + j, h - 1);
+            for (std::size_t c = 0; c < bytes_per_pixel; ++c)
+              texels[j * tile_size + i][c] =
+                  image[(y * w + x) * bytes_per_pixel + c];
+          }
+        bc1::compress(texels, out);
+        out += bc1::block_size;
+      }
+    return out;
+  }
+
+  /// Size in bytes of the mip-map pyramid of a w x h image
+  static std::size_t pyramid_size(format f, std::size_t w, std::size_t h) {
+    std::size_t size = image_texture::level_size(f, w, h);
+    while (w > 1 || h > 1) {
+      w = std::max<std::size_t>(w / 2, 1);
+      h = std::max<std::size_t>(h / 2, 1);
+      size += image_texture::level_size(f, w, h);
+    }
+    return size;
+  }
+
+  /// Halve an image with a box filter, the last row or column being reused
+  /// for the odd sizes
+  static std::vector<uint8_t> downsample(const std::vector<uint8_t>& image,
+                                         std::size_t w, std::size_t h) {
+    const auto nw = std::max<std::size_t>(w / 2, 1);
+    const auto nh = std::max<std::size_t>(h / 2, 1);
+    std::vector<uint8_t> half(nw * nh * bytes_per_pixel);
+    for (std::size_t y = 0; y < nh; ++y)
+      for (std::size_t x = 0; x < nw; ++x) {
+        const auto x0 = 2 * x, x1 = std::min(2 * x + 1, w - 1);
+        const auto y0 = 2 * y, y1 = std::min(2 * y + 1, h - 1);
+        for (std::size_t c = 0; c < bytes_per_pixel; ++c) {
+          auto texel = [&](std::size_t i, std::size_t j) {
+            return image[(j * w + i) * bytes_per_pixel + c];
+          };
+          half[(y * nw + x) * bytes_per_pixel + c] = static_cast<uint8_t>(
+              (texel(x0, y0) + texel(x1, y0) + texel(x0, y1) +
+               texel(x1, y1) + 2) /
+              4);
+        }
+      }
+    return half;
+  }
+
+  /// Decode the pending images into their places with a thread per core,
+  /// or read them from the cache
+  void load_pending() {
+    if (pending.empty() && blocks.empty())
+      return;
+    // Keep whole rows of the 2D buffer
+    texture_data.resize((reserved + bytes_per_pixel - 1) / bytes_per_pixel *
+                        bytes_per_pixel);
+    for (const auto& b : blocks)
+      std::copy(b.bytes.begin(), b.bytes.end(), &texture_data[b.offset]);
+    blocks.clear();
+    if (pending.empty())
+      return;
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<std::size_t> next = 0;
+    std::atomic<std::size_t> nb_cached = 0;
+    /// Serialize the error messages and the texture store updates
+    std::mutex mutex;
+    auto worker = [&] {
+      for (std::size_t i; (i = next++) < pending.size();) {
+        const auto& p = pending[i];
+        const auto cache_file = cache_path(p);
+        auto* resident = &texture_data[p.offset];
+        std::size_t data_offset;
+        if (!cache_file.empty() &&
+            read_cache(cache_file, p, resident, data_offset))
+          ++nb_cached;
+        else {
+          // A streamed pyramid is only whole in memory until it is cached
+          std::vector<uint8_t> pyramid(
+              p.paged_size ? pyramid_size(p.texel_format, p.width, p.height)
+                           : 0);
+          auto* out = p.paged_size ? pyramid.data() : resident;
+          const bool decoded = decode(p, out);
+          if (!decoded) {
+            // Use the fallback color over the whole image
+            std::vector<uint8_t> fallback(p.width * p.height *
+                                          bytes_per_pixel);
+            for (std::size_t t = 0; t < fallback.size(); t += bytes_per_pixel)
+              std::copy_n(texture_data.data(), bytes_per_pixel, &fallback[t]);
+            write_pyramid(p, std::move(fallback), out);
+          }
+          std::copy(pyramid.begin() + std::min(p.paged_size, pyramid.size()),
+                    pyramid.end(), resident);
+          if (!decoded) {
+            std::lock_guard lock { mutex };
+            std::cerr << "ERROR: Could not load texture image file '"
+                      << p.file_name << "'.\n"
+                      << stbi_failure_reason() << std::endl;
+            continue;
+          }
+          if (!cache_file.empty() &&
+              !write_cache(cache_file, p, out, data_offset)) {
+            std::lock_guard lock { mutex };
+            std::cerr << "ERROR: Could not write texture cache '"
+                      << cache_file.string() << "'." << std::endl;
+            continue;
+          }
+        }
+        if (p.paged_size) {
+          std::lock_guard lock { mutex };
+          store.map(cache_file, data_offset, p.paged_size, p.first_page);
+        }
+      }
+    };
+    const auto nb_threads = std::min<std::size_t>(
+        std::max(1u, std::thread::hardware_concurrency()), pending.size());
+    std::vector<std::thread> threads;
+    for (std::size_t t = 1; t < nb_threads; ++t)
+      threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+      t.join();
+    std::cerr << "textures: " << pending.size() - nb_cached << " decoded, "
+              << nb_cached << " read from cache in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - start)
+                     .count()
+              << " ms" << std::endl;
+    pending.clear();
+  }
+
+  /// Decode an image and write its mip-map pyramid to out
+  static bool decode(const pending_image& p, uint8_t* out) {
+    int _w, _h, components_per_pixel;
+    uint8_t* _data = stbi_load(p.file_name.c_str(), &_w, &_h,
+                               &components_per_pixel, bytes_per_pixel);
+    if (!_data)
+      return false;
+    // The file may have changed since its size was read
+    if (static_cast<std::size_t>(_w) != p.width ||
+        static_cast<std::size_t>(_h) != p.height) {
+      stbi_image_free(_data);
+      return false;
+    }
+    std::vector<uint8_t> level(_data,
+                               _data + bytes_per_pixel * p.width * p.height);
+    stbi_image_free(_data);
+    write_pyramid(p, std::move(level), out);
+    return true;
+  }
+
+  /// Write the mip-map pyramid of an image to out
+  static void write_pyramid(const pending_image& p, std::vector<uint8_t> level,
+                            uint8_t* out) {
+    auto write = p.texel_format == format::bc1 ? write_bc1 : write_tiled;
+    std::size_t w = p.width, h = p.height;
+    out = write(level, w, h, out);
+    while (w > 1 || h > 1) {
+      level = downsample(level, w, h);
+      w = std::max<std::size_t>(w / 2, 1);
+      h = std::max<std::size_t>(h / 2, 1);
+      out = write(level, w, h, out);
+    }
+  }
+
+  /// Header of a cached image, followed by the path of the image file and
+  /// by the texels of its pyramid
+  struct cache_header {
+    char magic[8];
+    /// Modification time of the image file
+    std::int64_t mtime;
+    std::uint64_t width;
+    std::uint64_t height;
+    std::uint64_t texel_format;
+    std::uint64_t path_size;
+  };
+  static constexpr char cache_magic[8] = { 'S', 'Y', 'R', 'T',
+                                           'T', 'E', 'X', '2' };
+
+  /// The cache file of an image, empty if there is no cache
+  std::filesystem::path cache_path(const pending_image& p) const {
+    if (cache_directory.empty())
+      return {};
+    std::error_code ec;
+    const auto path = std::filesystem::absolute(p.file_name, ec).string();
+    char name[40];
+    std::snprintf(name, sizeof(name), "%016zx.%s",
+                  std::hash<std::string> {}(path),
+                  p.texel_format == format::bc1 ? "bc1" : "tex");
+    return cache_directory / name;
+  }
+
+  /// Fill the header identifying the current version of an image file
+  static bool make_cache_header(const pending_image& p, cache_header& h,
+                                std::string& path) {
+    std::error_code ec;
+    const auto mtime = std::filesystem::last_write_time(p.file_name, ec);
+    if (ec)
+      return false;
+    path = std::filesystem::absolute(p.file_name, ec).string();
+    std::memcpy(h.magic, cache_magic, sizeof(cache_magic));
+    h.mtime = mtime.time_since_epoch().count();
+    h.width = p.width;
+    h.height = p.height;
+    h.texel_format = static_cast<std::uint64_t>(p.texel_format);
+    h.path_size = path.size();
+    return true;
+  }
+
+  /** Read the resident texels of an image from the cache if they are up to
+      date
+
+      \param[out] data_offset is the offset of the pyramid in the file
+  */
+  static bool read_cache(const std::filesystem::path& cache_file,
+                         const pending_image& p, uint8_t* resident,
+                         std::size_t& data_offset) {
+    cache_header expected, h;
+    std::string path;
+    if (!make_cache_header(p, expected, path))
+      return false;
+    std::ifstream in { cache_file, std::ios::binary };
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+        std::memcmp(&h, &expected, sizeof(h)) != 0)
+      return false;
+    std::string cached_path(h.path_size, '\0');
+    if (!in.read(cached_path.data(), cached_path.size()) || cached_path != path)
+      return false;
+    data_offset = sizeof(h) + path.size();
+    in.seekg(p.paged_size, std::ios::cur);
+    return static_cast<bool>(in.read(
+        reinterpret_cast<char*>(resident),
+        pyramid_size(p.texel_format, p.width, p.height) - p.paged_size));
+  }
+
+  /// Write the texels of an image to the cache, through a temporary file
+  /// renamed when complete so that a concurrent run never reads a partial one
+  static bool write_cache(const std::filesystem::path& cache_file,
+                          const pending_image& p, const uint8_t* pyramid,
+                          std::size_t& data_offset) {
+    cache_header h;
+    std::string path;
+    if (!make_cache_header(p, h, path))
+      return false;
+    auto temporary = cache_file;
+    temporary += ".tmp" + std::to_string(getpid());
+    std::ofstream out { temporary, std::ios::binary };
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(path.data(), path.size());
+    out.write(reinterpret_cast<const char*>(pyramid),
+              pyramid_size(p.texel_format, p.width, p.height));
+    out.close();
+    data_offset = sizeof(h) + path.size();
+    std::error_code ec;
+    if (!out) {
+      std::filesystem::remove(temporary, ec);
+      return false;
+    }
+    std::filesystem::rename(temporary, cache_file, ec);
+    return !ec;
+  }
+};
 
-// Start filled with the fallback texture (solid blue) for texture load error
-std::vector<uint8_t> image_texture::texture_data { 0, 0, 1 };
-bool image_texture::frozen = false;
 #endif
@@ -0,0 +1,207 @@
+#ifndef RT_SYCL_TEXTURE_STORE_HPP
+#define RT_SYCL_TEXTURE_STORE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <list>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Residency of the streamed image textures in a bounded pool of pages
+
+    The mip-map pyramid of a streamed texture is not loaded in memory but
+    left in its file of the texture cache, which is mapped and cut into pages
+    of page_size bytes. Only the pages used by the rendering are copied to a
+    pool of a fixed number of slots on the device, a page table giving the
+    slot of each resident page.
+
+    A lookup in a page which is not resident falls back to the coarse levels
+    of the texture, which are always in memory, and marks the page as used.
+    After each rendering pass, update() reads these marks, loads the missing
+    pages and keeps the most recently used ones, evicting the least recently
+    used pages when the pool is full. The memory used by the textures is then
+    bounded by the size of the pool whatever the size of the images.
+*/
+class texture_store {
+ public:
+  /// Bytes of a page: 64 tiles of 4 x 4 RGB texels, or 384 BC1 blocks, so
+  /// that no texel nor block straddles 2 pages
+  static constexpr std::size_t page_size = 3072;
+
+  /// Slot of the pages which are not resident
+  static constexpr std::uint32_t not_resident = ~0u;
+
+  struct statistics {
+    /// Used pages which were resident, over all the updates
+    std::uint64_t hits = 0;
+    /// Used pages which were not resident
+    std::uint64_t misses = 0;
+    /// Pages evicted to load missing ones
+    std::uint64_t evictions = 0;
+    /// Missing pages which could not be loaded because all the slots held
+    /// pages used in the same pass
+    std::uint64_t deferred = 0;
+  };
+
+  texture_store() = default;
+  texture_store(const texture_store&) = delete;
+  texture_store& operator=(const texture_store&) = delete;
+
+  ~texture_store() {
+    for (const auto& f : files)
+      munmap(f.mapping, f.size);
+  }
+
+  /// Stream the textures through a pool of nb_slots pages, 0 disabling it
+  void set_pool_size(std::size_t nb_slots) {
+    slot_page.assign(nb_slots, not_resident);
+    slot_pass.assign(nb_slots, 0);
+    lru.clear();
+    lru_position.clear();
+    for (std::uint32_t s = 0; s < nb_slots; ++s)
+      lru_position.push_back(lru.insert(lru.end(), s));
+  }
+
+  bool enabled() const { return !slot_page.empty(); }
+
+  std::size_t pool_slots() const { return slot_page.size(); }
+
+  /// Number of pages of all the streamed textures
+  std::size_t page_count() const { return sources.size(); }
+
+  /// Reserve the pages of size bytes of texture data, returning the index
+  /// of the first one
+  std::uint32_t reserve(std::size_t size) {
+    const auto first = static_cast<std::uint32_t>(sources.size());
+    sources.resize(sources.size() + (size + page_size - 1) / page_size);
+    return first;
+  }
+
+  /** Map the data of the pages reserved from first_page, found in a file
+      from an offset
+
+      \return false after printing an error if the file cannot be mapped,
+      the pages then never becoming resident
+  */
+  bool map(const std::filesystem::path& file_name, std::size_t offset,
+           std::size_t size, std::uint32_t first_page) {
+    const int fd = ::open(file_name.c_str(), O_RDONLY);
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        static_cast<std::size_t>(st.st_size) >= offset + size)
+      mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd >= 0)
+      close(fd);
+    if (mapping == MAP_FAILED) {
+      std::cerr << "ERROR: Could not map texture cache '" << file_name.string()
+                << "'." << std::endl;
+      return false;
+    }
+    files.push_back({ mapping, static_cast<std::size_t>(st.st_size) });
+    const auto* data = static_cast<const std::uint8_t*>(mapping) + offset;
+    for (std::size_t p = 0; p * page_size < size; ++p)
+      sources[first_page + p] = { data + p * page_size,
+                                  std::min(page_size, size - p * page_size) };
+    return true;
+  }
+
+  /** Account for the pages used by a rendering pass and make them resident
+
+      \param[in,out] usage is non-zero for the pages used during the pass,
+      and is reset
+
+      \param[in,out] table is the slot of each page
+
+      \param[out] pool receives the loaded pages
+  */
+  void update(std::uint32_t* usage, std::uint32_t* table, std::uint8_t* pool) {
+    ++pass;
+    std::vector<std::uint32_t> missing;
+    for (std::uint32_t page = 0; page < sources.size(); ++page) {
+      if (!usage[page])
+        continue;
+      usage[page] = 0;
+      if (const auto slot = table[page]; slot != not_resident) {
+        ++stats.hits;
+        slot_pass[slot] = pass;
+        lru.splice(lru.end(), lru, lru_position[slot]);
+      } else if (sources[page].data) {
+        ++stats.misses;
+        missing.push_back(page);
+      }
+    }
+    for (std::size_t i = 0; i < missing.size(); ++i) {
+      const auto page = missing[i];
+      const auto slot = lru.front();
+      // The pages used by this pass are the most recent ones, so all the
+      // slots hold them when the least recent one does
+      if (slot_pass[slot] == pass) {
+        stats.deferred += missing.size() - i;
+        break;
+      }
+      if (const auto evicted = slot_page[slot]; evicted != not_resident) {
+        table[evicted] = not_resident;
+        ++stats.evictions;
+      }
+      std::memcpy(pool + slot * page_size, sources[page].data,
+                  sources[page].size);
+      table[page] = slot;
+      slot_page[slot] = page;
+      slot_pass[slot] = pass;
+      lru.splice(lru.end(), lru, lru_position[slot]);
+    }
+  }
+
+  const statistics& get_statistics() const { return stats; }
+
+  /// Number of slots holding a page
+  std::size_t resident_pages() const {
+    return std::count_if(slot_page.begin(), slot_page.end(),
+                         [](auto p) { return p != not_resident; });
+  }
+
+  /// Print the page statistics
+  void print_statistics(std::ostream& out) const {
+    const auto used = stats.hits + stats.misses;
+    out << "texture pages: " << stats.hits << " hits, " << stats.misses
+        << " misses (" << (used ? 100.0 * stats.hits / used : 100.0)
+        << "% hits), " << stats.evictions << " evictions, " << stats.deferred
+        << " deferred, " << resident_pages() << "/" << pool_slots()
+        << " slots of " << page_count() << " pages resident" << std::endl;
+  }
+
+ private:
+  struct mapped_file {
+    void* mapping;
+    std::size_t size;
+  };
+  std::vector<mapped_file> files;
+
+  /// Where the data of a page is mapped
+  struct page_source {
+    const std::uint8_t* data = nullptr;
+    std::size_t size = 0;
+  };
+  std::vector<page_source> sources;
+
+  /// The page held by each slot
+  std::vector<std::uint32_t> slot_page;
+  /// The last pass which used each slot
+  std::vector<std::uint64_t> slot_pass;
+  /// The slots from the least to the most recently used
+  std::list<std::uint32_t> lru;
+  std::vector<std::list<std::uint32_t>::iterator> lru_position;
+
+  std::uint64_t pass = 0;
+  statistics stats;
+};
+
+#endif
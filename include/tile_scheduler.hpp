@@ -0,0 +1,83 @@
+#ifndef RT_SYCL_TILE_SCHEDULER_HPP
+#define RT_SYCL_TILE_SCHEDULER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "sycl.hpp"
+
+/** Work-stealing distribution of image tiles between workers
+
+    Each worker owns a queue holding a contiguous range of tile indices, so
+    that it starts by rendering one band of the image with good locality. A
+    queue is a single 64-bit word packing the [head, tail) range of the tiles
+    not yet taken. The owner pops tiles from the head while idle workers steal
+    from the tail of the others, so the cost imbalance between cheap sky tiles
+    and expensive glass or smoke tiles does not leave workers idle at the end
+    of a frame.
+
+    This is meant for CPU devices, with about one worker per compute unit.
+*/
+namespace tile_scheduler {
+
+inline std::uint64_t pack(std::uint32_t head, std::uint32_t tail) {
+  return (std::uint64_t { tail } << 32) | head;
+}
+
+/// Create the initial queues, evenly splitting nb_tiles between nb_workers
+inline std::vector<std::uint64_t> make_queues(std::uint32_t nb_tiles,
+                                              std::uint32_t nb_workers) {
+  std::vector<std::uint64_t> queues(nb_workers);
+  for (std::uint32_t w = 0; w < nb_workers; ++w)
+    queues[w] = pack(std::uint64_t { nb_tiles } * w / nb_workers,
+                     std::uint64_t { nb_tiles } * (w + 1) / nb_workers);
+  return queues;
+}
+
+/** Take a tile from a queue
+
+    \param[in] steal tells whether to take from the tail, as thieves do, or
+    from the head, as the owner does
+
+    \return false if the queue is empty
+*/
+inline bool pop(std::uint64_t& queue, bool steal, std::uint32_t& tile) {
+  sycl::atomic_ref<std::uint64_t, sycl::memory_order::relaxed,
+                   sycl::memory_scope::device,
+                   sycl::access::address_space::global_space>
+      q { queue };
+  auto old = q.load();
+  std::uint32_t head, tail;
+  do {
+    head = static_cast<std::uint32_t>(old);
+    tail = static_cast<std::uint32_t>(old >> 32);
+    if (head >= tail)
+      return false;
+  } while (!q.compare_exchange_weak(old, steal ? pack(head, tail - 1)
+                                               : pack(head + 1, tail)));
+  tile = steal ? tail - 1 : head;
+  return true;
+}
+
+/** Get the next tile a worker has to render
+
+    \param[in] queues is an accessor to the queues of all the workers
+
+    \return false when all the tiles have been taken
+*/
+inline bool next_tile(auto& queues, std::uint32_t worker,
+                      std::uint32_t& tile) {
+  if (pop(queues[worker], false, tile))
+    return true;
+  // Our own queue is empty, try to steal from the others, starting with the
+  // next worker to spread the thieves
+  const std::uint32_t nb_workers = queues.get_count();
+  for (std::uint32_t i = 1; i < nb_workers; ++i)
+    if (pop(queues[(worker + i) % nb_workers], true, tile))
+      return true;
+  return false;
+}
+
+} // namespace tile_scheduler
+
+#endif
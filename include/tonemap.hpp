@@ -0,0 +1,154 @@
+#ifndef RT_SYCL_TONEMAP_HPP
+#define RT_SYCL_TONEMAP_HPP
+
+#include <cstdint>
+#include <string_view>
+
+#include "accumulation_buffer.hpp"
+#include "image_writer.hpp"
+#include "rtweekend.hpp"
+#include "sycl.hpp"
+#include "vec.hpp"
+
+/** Conversion of the accumulated samples to displayable pixels on the device
+
+    The average of the samples of each pixel is scaled by the exposure,
+    compressed by a tone mapping operator, gamma corrected and quantized to
+    8 bits by a kernel, so that only 3 bytes per pixel are read back instead
+    of a padded float3 frame buffer, and the host has nothing left to do but
+    encoding. For high dynamic range output, the kernel packs the scaled
+    colors to 4-byte RGBE instead.
+*/
+namespace tonemap {
+
+enum class operator_t {
+  /// Only clamp to [0, 1]
+  clamp,
+  /// c / (1 + c), compressing the highlights
+  reinhard,
+  /// Narkowicz's fit of the ACES filmic curve
+  aces
+};
+
+/// Read an operator name, returning false if it is unknown
+inline bool parse_operator(std::string_view name, operator_t& op) {
+  if (name == "clamp")
+    op = operator_t::clamp;
+  else if (name == "reinhard")
+    op = operator_t::reinhard;
+  else if (name == "aces")
+    op = operator_t::aces;
+  else
+    return false;
+  return true;
+}
+
+struct parameters {
+  /// Scale of the colors before tone mapping
+  real_t exposure = 1;
+  operator_t op = operator_t::clamp;
+};
+
+/// Apply the tone mapping operator to a color component
+inline real_t map(operator_t op, real_t c) {
+  switch (op) {
+  case operator_t::reinhard:
+    return c / (1 + c);
+  case operator_t::aces:
+    return c * (2.51f * c + 0.03f) / (c * (2.43f * c + 0.59f) + 0.14f);
+  default:
+    return c;
+  }
+}
+
+/// Tone map, gamma correct with gamma 2 and quantize a color component
+inline std::uint8_t to_byte(const parameters& p, real_t c) {
+  const auto mapped = map(p.op, sycl::fmax(c * p.exposure, 0.0f));
+  return static_cast<std::uint8_t>(
+      256 * sycl::clamp(sycl::sqrt(mapped), 0.0f, 0.999f));
+}
+
+/** Pack a color to Ward's RGBE format: 3 mantissas sharing the exponent of
+    the largest component
+
+    \param[out] out receives the 4 bytes
+*/
+inline void to_rgbe(const color& c, std::uint8_t (&out)[4]) {
+  const auto v = sycl::fmax(c.x(), sycl::fmax(c.y(), c.z()));
+  if (!(v > 1e-32f)) {
+    for (int i = 0; i < 4; ++i)
+      out[i] = 0;
+    return;
+  }
+  // v = m * 2^e with m in [0.5, 1)
+  const auto e = static_cast<int>(sycl::floor(sycl::log2(v))) + 1;
+  const auto scale = 256 / sycl::exp2(static_cast<real_t>(e));
+  out[0] = static_cast<std::uint8_t>(sycl::fmin(c.x() * scale, 255.0f));
+  out[1] = static_cast<std::uint8_t>(sycl::fmin(c.y() * scale, 255.0f));
+  out[2] = static_cast<std::uint8_t>(sycl::fmin(c.z() * scale, 255.0f));
+  out[3] = static_cast<std::uint8_t>(e + 128);
+}
+
+class ResolveRGB8;
+class ResolveRGBE;
+
+/** Resolve the accumulation buffer to an image on the device
+
+    \param[in] hdr selects RGBE pixels, only scaled by the exposure, instead
+    of tone mapped RGB ones
+*/
+inline image_writer::byte_image resolve(sycl::queue& queue,
+                                        accumulation_buffer& accum,
+                                        const parameters& p, bool hdr) {
+  const auto width = accum.width();
+  const auto height = accum.height();
+  const std::size_t channels = hdr ? 4 : 3;
+  image_writer::byte_image image { width, height, channels,
+                                   std::vector<std::uint8_t>(
+                                       width * height * channels) };
+  {
+    // Written back to the image when going out of scope
+    sycl::buffer<std::uint8_t, 2> out_buf { image.pixels.data(),
+                                            sycl::range<2>(height,
+                                                           width * channels) };
+    queue.submit([&](sycl::handler& cgh) {
+      auto sum_acc = accum.sum.get_access<sycl::access::mode::read>(cgh);
+      auto stats_acc =
+          accum.statistics.get_access<sycl::access::mode::read>(cgh);
+      auto out_acc = out_buf.get_access<sycl::access::mode::discard_write>(cgh);
+      auto average = [=](std::size_t y, std::size_t x) {
+        const auto count = stats_acc[y][x].count;
+        return count ? sum_acc[y][x] / static_cast<real_t>(count)
+                     : color { 0.0f, 0.0f, 0.0f };
+      };
+      // The image rows go downwards, so flip the y axis
+      if (hdr)
+        cgh.parallel_for<ResolveRGBE>(
+            sycl::range<2>(height, width), [=](sycl::item<2> item) {
+              const auto y = item.get_id(0);
+              const auto x = item.get_id(1);
+              std::uint8_t rgbe[4];
+              to_rgbe(average(y, x) * p.exposure, rgbe);
+              auto row = out_acc[height - 1 - y];
+              for (int i = 0; i < 4; ++i)
+                row[4 * x + i] = rgbe[i];
+            });
+      else
+        cgh.parallel_for<ResolveRGB8>(
+            sycl::range<2>(height, width), [=](sycl::item<2> item) {
+              const auto y = item.get_id(0);
+              const auto x = item.get_id(1);
+              const auto c = average(y, x);
+              auto row = out_acc[height - 1 - y];
+              row[3 * x] = to_byte(p, c.x());
+              row[3 * x + 1] = to_byte(p, c.y());
+              row[3 * x + 2] = to_byte(p, c.z());
+            });
+    });
+  }
+  return image;
+}
+
+} // namespace tonemap
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef TRIANGLE_HPP
 #define TRIANGLE_HPP
 
+#include "aabb.hpp"
 #include "material.hpp"
 #include "ray.hpp"
+#include "ray_packet.hpp"
 #include "rtweekend.hpp"
 #include "texture.hpp"
 #include "vec.hpp"
@@ -105,18 +107,68 @@ class _triangle : public _triangle_coord {
  public:
   _triangle() = default;
   _triangle(const point& _v0, const point& _v1, const point& _v2,
-            const material_t& mat_type)
+            material_id mat)
       : _triangle_coord { _v0, _v1, _v2 }
-      , material_type { mat_type } {}
+      , material { mat } {}
 
   /// Compute ray interaction with triangle
-  bool hit(auto&, const ray& r, real_t min, real_t max, hit_record& rec,
-           material_t& hit_material_type) const {
-    hit_material_type = material_type;
-    return IntersectionStrategy(r, *this, min, max, rec);
+  bool hit(auto&, const ray& r, real_t min, real_t max,
+           hit_record& rec) const {
+    if (!IntersectionStrategy(r, *this, min, max, rec))
+      return false;
+    rec.material = material;
+    return true;
   }
 
-  material_t material_type;
+  /** Intersect a packet of rays with the triangle
+
+      Branch-free version of the Möller-Trumbore test so that the loop over
+      the rays is vectorized. It is only provided for this intersection
+      strategy, the others falling back to tracing the rays one by one.
+
+      \param[out] t is the hit distance of each ray between min and its max,
+      or infinity if it misses
+  */
+  template <std::size_t N>
+  void hit_packet(const ray_packet<N>& r, real_t min,
+                  const typename ray_packet<N>::lanes& max,
+                  typename ray_packet<N>::lanes& t) const
+    requires(IntersectionStrategy == moller_trumbore_triangle_intersec)
+  {
+    constexpr auto epsilon = 0.0000001f;
+    const auto edge1 = v1 - v0;
+    const auto edge2 = v2 - v0;
+    for (std::size_t i = 0; i < N; ++i) {
+      // h = direction x edge2
+      const auto hx = r.dy[i] * edge2.z() - r.dz[i] * edge2.y();
+      const auto hy = r.dz[i] * edge2.x() - r.dx[i] * edge2.z();
+      const auto hz = r.dx[i] * edge2.y() - r.dy[i] * edge2.x();
+      const auto a = edge1.x() * hx + edge1.y() * hy + edge1.z() * hz;
+      const auto a_abs = sycl::fabs(a);
+      const auto a_pos = a > 0.f;
+      const auto sx = r.ox[i] - v0.x();
+      const auto sy = r.oy[i] - v0.y();
+      const auto sz = r.oz[i] - v0.z();
+      const auto u = sx * hx + sy * hy + sz * hz;
+      // q = s x edge1
+      const auto qx = sy * edge1.z() - sz * edge1.y();
+      const auto qy = sz * edge1.x() - sx * edge1.z();
+      const auto qz = sx * edge1.y() - sy * edge1.x();
+      const auto v = r.dx[i] * qx + r.dy[i] * qy + r.dz[i] * qz;
+      const auto length =
+          (edge2.x() * qx + edge2.y() * qy + edge2.z() * qz) / a;
+      const auto hit = a_abs >= epsilon && ((u > 0.f) == a_pos) &&
+                       sycl::fabs(u) <= a_abs && ((v > 0.f) == a_pos) &&
+                       sycl::fabs(u + v) <= a_abs && length >= min &&
+                       length <= max[i];
+      t[i] = hit ? length : infinity;
+    }
+  }
+
+  /// Bounding box of the triangle, padded if it is axis aligned
+  aabb bounding_box() const { return aabb { v0, v1 }.merge(v2).pad(); }
+
+  material_id material;
 };
 
 using triangle = _triangle<>;
@@ -0,0 +1,525 @@
+#ifndef RT_SYCL_WAVEFRONT_HPP
+#define RT_SYCL_WAVEFRONT_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <variant>
+
+#include "accumulation_buffer.hpp"
+#include "camera.hpp"
+#include "hitable.hpp"
+#include "instrumentation.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "render.hpp"
+#include "render_parameters.hpp"
+#include "rtweekend.hpp"
+#include "sycl.hpp"
+#include "vec.hpp"
+
+/** Wavefront path tracing
+
+    Instead of following each path to its end in a single kernel as
+    render_pixel does, the paths of one sample of every pixel are advanced
+    together one bounce at a time by a sequence of small kernels:
+
+    - generation of the camera rays;
+
+    - closest hit, which sorts the paths into one queue per material type
+      and a queue for the rays leaving the scene;
+
+    - one shading kernel per material type, so that the work-items of a
+      kernel all run the same material code, pushing the scattered rays to
+      the queue of the next bounce;
+
+    - background for the rays leaving the scene.
+
+    A path adds the light it gathered to its pixel when it ends.
+
+    The path state lives in buffers in structure of arrays layout, indexed
+    by the linear pixel index since each pixel has a single path in flight.
+    The random generator of a path is the one of its pixel in the
+    accumulation buffer, so the image is the same as with render_pixel up to
+    the rounding of the accumulation.
+
+    The queue counters are reset and read by the kernels on the device: the
+    kernels consuming a queue are launched on an upper bound of its size and
+    their extra work-items return at once. The host only reads the counters
+    once per bounce, to launch the shading kernels and to stop when no path
+    is left.
+*/
+namespace wavefront {
+
+/// Number of material types, each having its own shading queue
+constexpr std::uint32_t nb_material_types = std::variant_size_v<material_t>;
+
+/// Index of the counters of the queues filled by the kernels
+enum counter : std::uint32_t {
+  /// The 2 counters of the ray queues, for the even and odd bounces
+  ray_counters,
+  misses = ray_counters + 2,
+  /// First of the nb_material_types counters of the shading queues
+  materials,
+  nb_counters = materials + nb_material_types
+};
+
+/// State of the paths in flight and their queues
+class path_buffers {
+ public:
+  explicit path_buffers(std::size_t nb_paths)
+      : origin { sycl::range<1>(nb_paths) }
+      , direction { sycl::range<1>(nb_paths) }
+      , time { sycl::range<1>(nb_paths) }
+      , state { sycl::range<1>(nb_paths) }
+      , hit { sycl::range<1>(nb_paths) }
+      , rays { sycl::buffer<std::uint32_t, 1> { sycl::range<1>(nb_paths) },
+               sycl::buffer<std::uint32_t, 1> { sycl::range<1>(nb_paths) } }
+      , miss_queue { sycl::range<1>(nb_paths) }
+      , material_queues { sycl::range<2>(nb_material_types, nb_paths) }
+      , counters { sycl::range<1>(nb_counters) }
+      , rounds { sycl::range<1>(nb_paths) } {}
+
+  /// Number of paths the buffers can hold, that is of pixels
+  std::size_t capacity() const { return origin.get_range()[0]; }
+
+  /// Read all the queue counters back on the host at once
+  std::array<std::uint32_t, nb_counters> counts() {
+    auto acc = counters.get_access<sycl::access::mode::read>();
+    std::array<std::uint32_t, nb_counters> c;
+    for (std::uint32_t i = 0; i < nb_counters; ++i)
+      c[i] = acc[i];
+    return c;
+  }
+
+  /// Current ray of each path
+  sycl::buffer<point, 1> origin;
+  sycl::buffer<vec, 1> direction;
+  sycl::buffer<real_t, 1> time;
+  /// Light gathered and throughput of each path so far
+  sycl::buffer<path_state, 1> state;
+  /// Closest hit of the current ray of each path
+  sycl::buffer<hit_record, 1> hit;
+
+  /// Paths whose ray has to be intersected, for the current and the next
+  /// bounce
+  sycl::buffer<std::uint32_t, 1> rays[2];
+  /// Paths whose ray leaves the scene
+  sycl::buffer<std::uint32_t, 1> miss_queue;
+  /// Paths to shade, one row per material type
+  sycl::buffer<std::uint32_t, 2> material_queues;
+  /// Number of elements of the queues filled by the kernels
+  sycl::buffer<std::uint32_t, 1> counters;
+  /// Rounds of samples of each pixel in the current pass, see
+  /// adaptive_sampling::boost()
+  sycl::buffer<std::uint32_t, 1> rounds;
+};
+
+/// Append a path to a queue
+inline void push(auto& queue, auto& counters_acc, std::uint32_t counter,
+                 std::uint32_t path) {
+  sycl::atomic_ref<std::uint32_t, sycl::memory_order::relaxed,
+                   sycl::memory_scope::device,
+                   sycl::access::address_space::global_space>
+      c { counters_acc[counter] };
+  queue[c.fetch_add(1)] = path;
+}
+
+class ResetCounters;
+class Generate;
+class ClosestHit;
+class Miss;
+template <std::size_t MaterialType> class Shade;
+class Terminate;
+class CountActive;
+
+/** Accessors used by the kernels ending paths
+
+    A path ends by adding its color to the sample sum and statistics of its
+    pixel, along with the number of rays it traced.
+*/
+template <typename SumAcc, typename StatsAcc> struct pixel_output {
+  void add(std::uint32_t path, const color& c,
+           std::uint32_t path_length) const {
+    const auto y = path / width;
+    const auto x = path % width;
+    sum[y][x] += c;
+    // Cannot use a reference on the element with all the accessor types
+    pixel_statistics s = stats[y][x];
+    s.add(c, path_length);
+    stats[y][x] = s;
+  }
+
+  SumAcc sum;
+  StatsAcc stats;
+  std::uint32_t width;
+};
+
+/// Set to 0 the counters of the shading queues, of the miss queue and of
+/// the ray queue ray_queue, on the device
+inline void reset_counters(sycl::queue& queue, path_buffers& paths,
+                           std::uint32_t ray_queue) {
+  queue.submit([&](sycl::handler& cgh) {
+    auto counters_acc =
+        paths.counters.get_access<sycl::access::mode::read_write>(cgh);
+    cgh.single_task<ResetCounters>([=] {
+      counters_acc[ray_counters + ray_queue] = 0;
+      for (std::uint32_t i = misses; i < nb_counters; ++i)
+        counters_acc[i] = 0;
+    });
+  });
+}
+
+/** Create the camera ray of a sample of each pixel still sampled
+
+    The first sample of a pass draws the number of rounds of samples of each
+    pixel like render_pass, 0 for a converged pixel, so that a pixel takes
+    part in the samples of the pass up to rounds times params.samples.
+
+    \param[in] sample is the index of the sample in the pass
+*/
+inline void generate(sycl::queue& queue, path_buffers& paths,
+                     accumulation_buffer& accum, const camera& cam,
+                     const render_parameters& params,
+                     const adaptive_sampling& adaptive, float boost,
+                     int sample) {
+  reset_counters(queue, paths, 0);
+  queue.submit([&](sycl::handler& cgh) {
+    auto rng_acc =
+        accum.rng_state.get_access<sycl::access::mode::read_write>(cgh);
+    auto stats_acc = accum.statistics.get_access<sycl::access::mode::read>(cgh);
+    auto origin_acc =
+        paths.origin.get_access<sycl::access::mode::discard_write>(cgh);
+    auto direction_acc =
+        paths.direction.get_access<sycl::access::mode::discard_write>(cgh);
+    auto time_acc =
+        paths.time.get_access<sycl::access::mode::discard_write>(cgh);
+    auto state_acc =
+        paths.state.get_access<sycl::access::mode::discard_write>(cgh);
+    auto rays_acc = paths.rays[0].get_access<sycl::access::mode::write>(cgh);
+    auto counters_acc =
+        paths.counters.get_access<sycl::access::mode::read_write>(cgh);
+    auto rounds_acc =
+        paths.rounds.get_access<sycl::access::mode::read_write>(cgh);
+    auto pixel_counters_acc =
+        accum.counters.get_access<sycl::access::mode::read_write>(cgh);
+    const auto width = params.width;
+    const auto height = params.height;
+    const std::uint32_t round = sample / params.samples;
+    cgh.parallel_for<Generate>(
+        sycl::range<2>(height, width), [=](sycl::item<2> item) {
+          const auto y = item.get_id(0);
+          const auto x = item.get_id(1);
+          const std::uint32_t path = y * width + x;
+          LocalPseudoRNG rng(rng_acc[y][x]);
+          if (sample == 0) {
+            std::uint32_t rounds = 0;
+            if (!adaptive.enabled() ||
+                !stats_acc[y][x].converged(adaptive.threshold,
+                                           adaptive.min_samples)) {
+              rounds = static_cast<std::uint32_t>(boost);
+              if (boost > rounds && rng.float_t() < boost - rounds)
+                ++rounds;
+            }
+            rounds_acc[path] = rounds;
+          }
+          if (round >= rounds_acc[path]) {
+            rng_acc[y][x] = rng.state();
+            return;
+          }
+          const auto u = (x + rng.float_t()) / width;
+          const auto v = (y + rng.float_t()) / height;
+          const auto r = cam.get_ray(u, v, rng);
+          rng_acc[y][x] = rng.state();
+          origin_acc[path] = r.origin();
+          direction_acc[path] = r.direction();
+          time_acc[path] = r.time();
+          path_state state;
+          state.cone_spread = cam.pixel_spread(height);
+          state_acc[path] = state;
+          push(rays_acc, counters_acc, ray_counters, path);
+          instrumentation::counters_t c;
+          c.add(instrumentation::paths);
+          instrumentation::add_to_pixel(pixel_counters_acc, y, x, c);
+        });
+  });
+}
+
+/** Find the closest hit of the rays of a bounce and sort them by what they
+    hit
+
+    \param[in] max_rays is an upper bound of the number of rays, whose
+    actual number is only read on the device
+*/
+inline void closest_hit(sycl::queue& queue, auto& scene, path_buffers& paths,
+                        accumulation_buffer& accum, std::uint32_t max_rays,
+                        int bounce) {
+  reset_counters(queue, paths, (bounce + 1) % 2);
+  queue.submit([&](sycl::handler& cgh) {
+    auto hittables_acc = scene.get_hittables_access(cgh);
+    auto material_acc = scene.get_material_access(cgh);
+    auto texture_acc = scene.get_texture_access(cgh);
+    auto rng_acc =
+        accum.rng_state.get_access<sycl::access::mode::read_write>(cgh);
+    auto origin_acc = paths.origin.get_access<sycl::access::mode::read>(cgh);
+    auto direction_acc =
+        paths.direction.get_access<sycl::access::mode::read>(cgh);
+    auto time_acc = paths.time.get_access<sycl::access::mode::read>(cgh);
+    auto hit_acc = paths.hit.get_access<sycl::access::mode::write>(cgh);
+    auto rays_acc =
+        paths.rays[bounce % 2].get_access<sycl::access::mode::read>(cgh);
+    auto miss_acc = paths.miss_queue.get_access<sycl::access::mode::write>(cgh);
+    auto material_queues_acc =
+        paths.material_queues.get_access<sycl::access::mode::write>(cgh);
+    auto counters_acc =
+        paths.counters.get_access<sycl::access::mode::read_write>(cgh);
+    auto pixel_counters_acc =
+        accum.counters.get_access<sycl::access::mode::read_write>(cgh);
+    const std::uint32_t width = accum.width();
+    const std::uint32_t ray_counter = ray_counters + bounce % 2;
+    cgh.parallel_for<ClosestHit>(sycl::range<1>(max_rays), [=](sycl::item<1>
+                                                                    item) {
+      if (item.get_id(0) >= counters_acc[ray_counter])
+        return;
+      const auto path = rays_acc[item.get_id()];
+      const auto y = path / width;
+      const auto x = path % width;
+      // Volumes use random numbers to find where a ray scatters
+      LocalPseudoRNG rng(rng_acc[y][x]);
+      render_context ctx { { rng, texture_acc.get_pointer(),
+                             texture_acc.pages() } };
+      const ray r { origin_acc[path], direction_acc[path], time_acc[path] };
+      hit_record rec;
+      if (hit_world(ctx, hittables_acc, r, rec)) {
+        hit_acc[path] = rec;
+        const std::uint32_t type = material_acc[rec.material].index();
+        auto material_queue = material_queues_acc[type];
+        push(material_queue, counters_acc, materials + type, path);
+      } else
+        push(miss_acc, counters_acc, misses, path);
+      rng_acc[y][x] = ctx.rng.state();
+      instrumentation::add_to_pixel(pixel_counters_acc, y, x, ctx.counters);
+    });
+  });
+}
+
+/// End the paths of the rays leaving the scene with the background color
+inline void miss(sycl::queue& queue, path_buffers& paths,
+                 accumulation_buffer& accum, std::uint32_t nb_misses,
+                 int bounce) {
+  queue.submit([&](sycl::handler& cgh) {
+    pixel_output out {
+      accum.sum.get_access<sycl::access::mode::read_write>(cgh),
+      accum.statistics.get_access<sycl::access::mode::read_write>(cgh),
+      static_cast<std::uint32_t>(accum.width())
+    };
+    auto direction_acc =
+        paths.direction.get_access<sycl::access::mode::read>(cgh);
+    auto state_acc = paths.state.get_access<sycl::access::mode::read>(cgh);
+    auto miss_acc = paths.miss_queue.get_access<sycl::access::mode::read>(cgh);
+    cgh.parallel_for<Miss>(sycl::range<1>(nb_misses), [=](sycl::item<1> item) {
+      const auto path = miss_acc[item.get_id()];
+      const ray r { point {}, direction_acc[path] };
+      const path_state state = state_acc[path];
+      out.add(path, state.radiance + state.throughput * background(r),
+              bounce + 1);
+    });
+  });
+}
+
+/** Shade the paths hitting a material of type MaterialType
+
+    A scattered path is pushed to the ray queue of the next bounce while an
+    absorbed path, or one ended by Russian roulette, ends.
+*/
+template <std::size_t MaterialType>
+void shade(sycl::queue& queue, auto& scene, path_buffers& paths,
+           accumulation_buffer& accum, const render_parameters& params,
+           std::uint32_t nb_paths, int bounce) {
+  queue.submit([&](sycl::handler& cgh) {
+    auto hittables_acc = scene.get_hittables_access(cgh);
+    auto material_acc = scene.get_material_access(cgh);
+    auto light_acc = scene.get_light_access(cgh);
+    auto texture_acc = scene.get_texture_access(cgh);
+    auto rng_acc =
+        accum.rng_state.get_access<sycl::access::mode::read_write>(cgh);
+    pixel_output out {
+      accum.sum.get_access<sycl::access::mode::read_write>(cgh),
+      accum.statistics.get_access<sycl::access::mode::read_write>(cgh),
+      static_cast<std::uint32_t>(accum.width())
+    };
+    auto origin_acc =
+        paths.origin.get_access<sycl::access::mode::read_write>(cgh);
+    auto direction_acc =
+        paths.direction.get_access<sycl::access::mode::read_write>(cgh);
+    auto time_acc = paths.time.get_access<sycl::access::mode::read_write>(cgh);
+    auto state_acc =
+        paths.state.get_access<sycl::access::mode::read_write>(cgh);
+    auto hit_acc = paths.hit.get_access<sycl::access::mode::read>(cgh);
+    auto material_queues_acc =
+        paths.material_queues.get_access<sycl::access::mode::read>(cgh);
+    auto next_rays_acc =
+        paths.rays[(bounce + 1) % 2].get_access<sycl::access::mode::write>(
+            cgh);
+    auto counters_acc =
+        paths.counters.get_access<sycl::access::mode::read_write>(cgh);
+    auto pixel_counters_acc =
+        accum.counters.get_access<sycl::access::mode::read_write>(cgh);
+    const std::uint32_t width = accum.width();
+    const bool light_sampling = params.light_sampling;
+    const int roulette_depth = params.roulette_depth;
+    cgh.parallel_for<Shade<MaterialType>>(
+        sycl::range<1>(nb_paths), [=](sycl::item<1> item) {
+          const auto path = material_queues_acc[MaterialType][item.get_id(0)];
+          const auto y = path / width;
+          const auto x = path % width;
+          LocalPseudoRNG rng(rng_acc[y][x]);
+          render_context ctx { { rng, texture_acc.get_pointer(),
+                                 texture_acc.pages() } };
+          const hit_record rec = hit_acc[path];
+          // No dispatch: all the paths of this kernel hit this material type
+          const auto& material =
+              std::get<MaterialType>(material_acc[rec.material]);
+          ray r { origin_acc[path], direction_acc[path], time_acc[path] };
+          path_state state = state_acc[path];
+          if (shade_hit(ctx, material, hittables_acc, material_acc,
+                        light_acc, light_sampling, r, rec, state) &&
+              survive_roulette(ctx, state, bounce, roulette_depth)) {
+            origin_acc[path] = r.origin();
+            direction_acc[path] = r.direction();
+            time_acc[path] = r.time();
+            push(next_rays_acc, counters_acc, ray_counters + (bounce + 1) % 2,
+                 path);
+          } else
+            out.add(path, state.radiance, bounce + 1);
+          state_acc[path] = state;
+          rng_acc[y][x] = ctx.rng.state();
+          instrumentation::add_to_pixel(pixel_counters_acc, y, x,
+                                        ctx.counters);
+        });
+  });
+}
+
+/** End the paths still bouncing after the maximum depth with the light they
+    gathered so far
+
+    \param[in] max_rays is an upper bound of the number of paths
+*/
+inline void terminate(sycl::queue& queue, path_buffers& paths,
+                      accumulation_buffer& accum, std::uint32_t max_rays,
+                      int bounce) {
+  queue.submit([&](sycl::handler& cgh) {
+    pixel_output out {
+      accum.sum.get_access<sycl::access::mode::read_write>(cgh),
+      accum.statistics.get_access<sycl::access::mode::read_write>(cgh),
+      static_cast<std::uint32_t>(accum.width())
+    };
+    auto rays_acc =
+        paths.rays[bounce % 2].get_access<sycl::access::mode::read>(cgh);
+    auto state_acc = paths.state.get_access<sycl::access::mode::read>(cgh);
+    auto counters_acc =
+        paths.counters.get_access<sycl::access::mode::read>(cgh);
+    auto pixel_counters_acc =
+        accum.counters.get_access<sycl::access::mode::read_write>(cgh);
+    const std::uint32_t width = accum.width();
+    const std::uint32_t ray_counter = ray_counters + bounce % 2;
+    cgh.parallel_for<Terminate>(
+        sycl::range<1>(max_rays), [=](sycl::item<1> item) {
+          if (item.get_id(0) >= counters_acc[ray_counter])
+            return;
+          const auto path = rays_acc[item.get_id()];
+          out.add(path, state_acc[path].radiance, bounce);
+          instrumentation::counters_t c;
+          c.add(instrumentation::max_depth_paths);
+          instrumentation::add_to_pixel(pixel_counters_acc, path / width,
+                                        path % width, c);
+        });
+  });
+}
+
+/// Count the pixels still to be sampled after this pass
+inline std::uint32_t count_active(sycl::queue& queue,
+                                  accumulation_buffer& accum,
+                                  const adaptive_sampling& adaptive) {
+  std::uint32_t active_pixels = 0;
+  {
+    auto active_buf =
+        sycl::buffer<std::uint32_t, 1>(&active_pixels, sycl::range<1>(1));
+    queue.submit([&](sycl::handler& cgh) {
+      auto stats_acc =
+          accum.statistics.get_access<sycl::access::mode::read>(cgh);
+      auto active_acc =
+          active_buf.get_access<sycl::access::mode::read_write>(cgh);
+      cgh.parallel_for<CountActive>(
+          accum.statistics.get_range(), [=](sycl::item<2> item) {
+            if (!stats_acc[item.get_id()].converged(adaptive.threshold,
+                                                    adaptive.min_samples))
+              sycl::atomic_ref<std::uint32_t, sycl::memory_order::relaxed,
+                               sycl::memory_scope::device,
+                               sycl::access::address_space::global_space> {
+                active_acc[0]
+              }++;
+          });
+    });
+  }
+  return active_pixels;
+}
+
+} // namespace wavefront
+
+/** Add params.samples paths per pixel to the accumulation buffer with the
+    wavefront kernels
+
+    With adaptive sampling, the converged pixels are skipped and the others
+    get more samples like with render_pass.
+
+    \param[in,out] paths holds the state of the paths, kept from one pass to
+    the next and at least as large as the image
+*/
+inline void render_pass_wavefront(sycl::queue& queue, auto& scene,
+                                  wavefront::path_buffers& paths,
+                                  const camera& cam,
+                                  accumulation_buffer& accum,
+                                  const render_parameters& params,
+                                  const adaptive_sampling& adaptive = {}) {
+  const std::uint32_t nb_pixels = params.width * params.height;
+  const float boost = adaptive.boost(nb_pixels, accum.active_pixels);
+  // The rounds of samples beyond the first one only sample the pixels
+  // drawing them
+  const int nb_samples = params.samples * static_cast<int>(std::ceil(boost));
+  for (int sample = 0; sample < nb_samples; ++sample) {
+    wavefront::generate(queue, paths, accum, cam, params, adaptive, boost,
+                        sample);
+    // Upper bound of the rays of the bounce, all the pixels at first then
+    // the paths scattered by the previous bounce
+    std::uint32_t max_rays = nb_pixels;
+    int bounce = 0;
+    for (; max_rays && bounce < params.depth; ++bounce) {
+      wavefront::closest_hit(queue, scene, paths, accum, max_rays, bounce);
+      const auto counts = paths.counts();
+      if (auto nb_misses = counts[wavefront::misses])
+        wavefront::miss(queue, paths, accum, nb_misses, bounce);
+      max_rays = 0;
+      [&]<std::size_t... Types>(std::index_sequence<Types...>) {
+        (
+            [&] {
+              if (auto n = counts[wavefront::materials + Types]) {
+                wavefront::shade<Types>(queue, scene, paths, accum, params,
+                                        n, bounce);
+                max_rays += n;
+              }
+            }(),
+            ...);
+      }(std::make_index_sequence<wavefront::nb_material_types> {});
+    }
+    if (max_rays)
+      wavefront::terminate(queue, paths, accum, max_rays, bounce);
+  }
+  accum.sample_count += params.samples;
+  accum.active_pixels = adaptive.enabled()
+                            ? wavefront::count_active(queue, accum, adaptive)
+                            : nb_pixels;
+}
+
+#endif
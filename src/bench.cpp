@@ -0,0 +1,303 @@
+/** Microbenchmarks of the building blocks of the path tracer
+
+    Each benchmark calls one function, such as a primitive hit test or a
+    material scatter, on a fixed set of inputs generated from fixed seeds, so
+    that the numbers of two builds can be compared to catch performance
+    regressions.
+
+    The functions are called directly on the host, outside of any kernel, to
+    measure their own cost without the scheduling of a SYCL runtime.
+
+    The primitive hit tests are run on a hit-heavy workload, where most rays
+    aim at the primitive, and on a miss-heavy workload, where most rays pass
+    beside it.
+*/
+#include "sycl.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "render.hpp"
+
+namespace {
+
+/// Like the task_context of the kernels, with a host pointer to the texture
+/// data and no streamed texture
+struct bench_context {
+  LocalPseudoRNG rng;
+  const std::uint8_t* texture_data;
+  struct {
+    const std::uint8_t* pool;
+    std::uint32_t* table;
+    std::uint32_t* usage;
+  } texture_pages {};
+  instrumentation::no_counters counters {};
+};
+
+struct bench_options {
+  /// Only run the benchmarks whose name contains this
+  std::string_view filter;
+  /// Minimum duration of each of the timed repetitions, in seconds
+  double min_time = 0.1;
+  /// The best of these repetitions is reported
+  int repetitions = 5;
+};
+
+/// Written with the results of the benchmarks so that they are not
+/// optimized away
+volatile float sink;
+
+/** Time op(i) for i in [0, nb_inputs), repeating over the inputs until
+    options.min_time elapses, and print the best time per call
+
+    \param[in] op returns a float summed over a first pass on the inputs
+    into a checksum, also printed to check that two builds compute the same
+    thing. The random generator of ctx is reset before it
+*/
+template <typename Op>
+void run(const bench_options& options, std::string_view name,
+         bench_context& ctx, std::size_t nb_inputs, Op&& op) {
+  if (name.find(options.filter) == std::string_view::npos)
+    return;
+  ctx.rng = LocalPseudoRNG { 1 };
+  float checksum = 0;
+  for (std::size_t i = 0; i < nb_inputs; ++i)
+    checksum += op(i);
+  using clock = std::chrono::steady_clock;
+  auto best = std::numeric_limits<double>::infinity();
+  for (int rep = 0; rep < options.repetitions; ++rep) {
+    std::size_t calls = 0;
+    float sum = 0;
+    const auto start = clock::now();
+    std::chrono::duration<double> elapsed;
+    do {
+      for (std::size_t i = 0; i < nb_inputs; ++i)
+        sum += op(i);
+      calls += nb_inputs;
+      elapsed = clock::now() - start;
+    } while (elapsed.count() < options.min_time);
+    best = std::min(best, elapsed.count() * 1e9 / calls);
+    sink = sum;
+  }
+  std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+            << std::setprecision(2) << std::setw(10) << best << std::setw(12)
+            << 1e3 / best << std::setw(14) << std::setprecision(6) << checksum
+            << std::endl;
+}
+
+constexpr std::size_t nb_inputs = 4096;
+
+/** Rays from a sphere of radius 5 around the origin aiming at a point at
+    most spread away from the origin, so most rays hit a primitive of size 1
+    at the origin for a small spread and most miss it for a large one
+*/
+std::vector<ray> make_rays(std::uint32_t seed, real_t spread) {
+  LocalPseudoRNG rng { seed };
+  std::vector<ray> rays;
+  for (std::size_t i = 0; i < nb_inputs; ++i) {
+    const point origin = 5 * rng.unit_vec();
+    const point target = spread * rng.in_unit_ball();
+    rays.emplace_back(origin, target - origin, rng.float_t());
+  }
+  return rays;
+}
+
+/// Benchmark the hit test of a primitive on both workloads
+void run_hit(const bench_options& options, std::string_view name,
+             const auto& primitive, bench_context& ctx,
+             const std::vector<ray>& hit_rays,
+             const std::vector<ray>& miss_rays) {
+  for (auto [workload, rays] : { std::pair { "hit", &hit_rays },
+                                 std::pair { "miss", &miss_rays } }) {
+    run(options, std::string { name } + "::hit/" + workload, ctx, nb_inputs,
+        [&](std::size_t i) {
+          hit_record rec;
+          return primitive.hit(ctx, (*rays)[i], 0.001f, infinity, rec) ? 1.f
+                                                                        : 0.f;
+        });
+  }
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --filter <text>      only run the benchmarks whose name\n"
+            << "                       contains <text>\n"
+            << "  --min-time <s>       minimum duration of each repetition "
+               "(0.1)\n"
+            << "  --repetitions <n>    repetitions, the best one being "
+               "reported (5)\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  bench_options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg { argv[i] };
+    if (arg == "--filter" && i + 1 < argc)
+      options.filter = argv[++i];
+    else if (arg == "--min-time" && i + 1 < argc)
+      options.min_time = std::atof(argv[++i]);
+    else if (arg == "--repetitions" && i + 1 < argc)
+      options.repetitions = std::atoi(argv[++i]);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (options.repetitions <= 0) {
+    std::cerr << "ERROR: The number of repetitions must be positive."
+              << std::endl;
+    return 1;
+  }
+
+  texture_table images;
+  const auto image = images.add_image("../images/Xilinx.jpg");
+  const auto compressed = images.add_image("../images/Xilinx.jpg", 1,
+                                           texture_table::format::bc1);
+  // A ball of smoke fading out from its center, in a grid of 32^3 voxels
+  // filling the unit box
+  constexpr std::uint32_t grid = 32;
+  std::vector<std::uint8_t> voxels(grid * grid * grid);
+  for (std::uint32_t z = 0; z < grid; ++z)
+    for (std::uint32_t y = 0; y < grid; ++y)
+      for (std::uint32_t x = 0; x < grid; ++x) {
+        const auto v = (vec { static_cast<real_t>(x), static_cast<real_t>(y),
+                              static_cast<real_t>(z) } +
+                        0.5f) /
+                           (grid / 2) -
+                       1;
+        voxels[(z * grid + y) * grid + x] = static_cast<std::uint8_t>(
+            255 * std::max(0.f, 1 - sycl::length(v)));
+      }
+  const grid_medium smoke_ball { { point { -1, -1, -1 }, point { 1, 1, 1 } },
+                                 1, grid, grid, grid, voxels, images, 0 };
+  auto texture_buf = images.freeze();
+  auto texture_acc = texture_buf.get_access<sycl::access::mode::read>();
+  bench_context ctx { LocalPseudoRNG { 1 }, &texture_acc[0][0] };
+
+  const auto hit_rays = make_rays(2, 0.5f);
+  const auto miss_rays = make_rays(3, 4);
+
+  std::cout << std::left << std::setw(40) << "benchmark" << std::right
+            << std::setw(10) << "ns/op" << std::setw(12) << "Mop/s"
+            << std::setw(14) << "checksum" << std::endl;
+
+  // Primitives of size about 1 at the origin
+  const sphere unit_sphere { point { 0, 0, 0 }, 1, 0 };
+  const point v0 { -1, -1, 0 }, v1 { 1, -1, 0.2f }, v2 { 0, 1, -0.2f };
+  run_hit(options, "sphere", unit_sphere, ctx, hit_rays, miss_rays);
+  run_hit(options, "triangle<moller_trumbore>",
+          _triangle<moller_trumbore_triangle_intersec> { v0, v1, v2, 0 }, ctx,
+          hit_rays, miss_rays);
+  run_hit(options, "triangle<badouel>",
+          _triangle<badouel_ray_triangle_intersec> { v0, v1, v2, 0 }, ctx,
+          hit_rays, miss_rays);
+  run_hit(options, "xy_rect", xy_rect { -1, 1, -1, 1, 0, 0 }, ctx, hit_rays,
+          miss_rays);
+  run_hit(options, "xz_rect", xz_rect { -1, 1, -1, 1, 0, 0 }, ctx, hit_rays,
+          miss_rays);
+  run_hit(options, "yz_rect", yz_rect { -1, 1, -1, 1, 0, 0 }, ctx, hit_rays,
+          miss_rays);
+  const box unit_box { point { -1, -1, -1 }, point { 1, 1, 1 }, 0 };
+  run_hit(options, "box", unit_box, ctx, hit_rays, miss_rays);
+  run_hit(options, "constant_medium",
+          constant_medium { unit_sphere, 0.5f, 0 }, ctx, hit_rays, miss_rays);
+  run_hit(options, "constant_medium<box>",
+          constant_medium { unit_box, 0.5f, 0 }, ctx, hit_rays, miss_rays);
+  run_hit(options, "grid_medium", smoke_ball, ctx, hit_rays, miss_rays);
+  run(options, "grid_medium::transmittance/hit", ctx, nb_inputs,
+      [&](std::size_t i) {
+        return smoke_ball.transmittance(ctx, hit_rays[i], 0.001f, infinity);
+      });
+
+  // Hit points on the sphere to shade
+  std::vector<ray> shaded_rays;
+  std::vector<hit_record> hits;
+  for (const auto& r : hit_rays) {
+    hit_record rec;
+    if (unit_sphere.hit(ctx, r, 0.001f, infinity, rec)) {
+      shaded_rays.push_back(r);
+      hits.push_back(rec);
+    }
+  }
+
+  const checker_texture checker { color { 0.2f, 0.3f, 0.1f },
+                                  color { 0.9f, 0.9f, 0.9f } };
+  const std::pair<const char*, material_t> materials[] = {
+    { "lambertian_material", lambertian_material { color { 0.5f, 0.5f, 0.5f } } },
+    { "lambertian_material<checker>", lambertian_material { checker } },
+    { "metal_material", metal_material { color { 0.7f, 0.6f, 0.5f }, 0.1f } },
+    { "dielectric_material",
+      dielectric_material { 1.5f, color { 1.0f, 1.0f, 1.0f } } },
+    { "lightsource_material",
+      lightsource_material { color { 10.0f, 10.0f, 10.0f } } },
+    { "isotropic_material", isotropic_material { color { 0.5f, 0.5f, 0.5f } } },
+  };
+  for (const auto& [name, material] : materials)
+    dev_visit(
+        [&](auto&& m) {
+          run(options, std::string { name } + "::scatter", ctx, hits.size(),
+              [&](std::size_t i) {
+                color attenuation { 1.0f, 1.0f, 1.0f };
+                ray scattered;
+                return m.scatter(ctx, shaded_rays[i], hits[i], attenuation,
+                                 scattered)
+                           ? attenuation.x() + scattered.direction().x()
+                           : 0.f;
+              });
+        },
+        material);
+
+  const std::pair<const char*, texture_t> textures[] = {
+    { "solid_texture", solid_texture { color { 0.5f, 0.5f, 0.5f } } },
+    { "checker_texture", checker },
+    { "image_texture", image },
+  };
+  for (const auto& [name, texture] : textures)
+    dev_visit(
+        [&](auto&& t) {
+          run(options, std::string { name } + "::value", ctx, hits.size(),
+              [&](std::size_t i) { return t.value(ctx, hits[i]).x(); });
+        },
+        texture);
+  // A ray footprint covering several texels, interpolating between 2 levels
+  // of the mip-map pyramid
+  auto minified_hits = hits;
+  for (auto& rec : minified_hits)
+    rec.footprint = 0.1f;
+  run(options, "image_texture::value/minified", ctx, hits.size(),
+      [&](std::size_t i) { return image.value(ctx, minified_hits[i]).x(); });
+  run(options, "image_texture::value/bc1", ctx, hits.size(),
+      [&](std::size_t i) { return compressed.value(ctx, hits[i]).x(); });
+  run(options, "image_texture::value/bc1/minified", ctx, hits.size(),
+      [&](std::size_t i) {
+        return compressed.value(ctx, minified_hits[i]).x();
+      });
+
+  const camera cam { point { 13, 2, 3 }, point { 0, 0, 0 }, vec { 0, 1, 0 },
+                     20, 5.0f / 3, 0.1f, 10 };
+  run(options, "camera::get_ray", ctx, nb_inputs, [&](std::size_t i) {
+    const auto u = (i % 64) / 64.0f;
+    const auto v = (i / 64) / 64.0f;
+    return cam.get_ray(u, v, ctx.rng).direction().x();
+  });
+
+  run(options, "LocalPseudoRNG::float_t", ctx, nb_inputs,
+      [&](std::size_t) { return ctx.rng.float_t(); });
+  run(options, "LocalPseudoRNG::unit_vec", ctx, nb_inputs,
+      [&](std::size_t) { return ctx.rng.unit_vec().x(); });
+  run(options, "LocalPseudoRNG::in_unit_ball", ctx, nb_inputs,
+      [&](std::size_t) { return ctx.rng.in_unit_ball().x(); });
+  run(options, "LocalPseudoRNG::in_unit_disk", ctx, nb_inputs,
+      [&](std::size_t) { return ctx.rng.in_unit_disk().x(); });
+  return 0;
+}
@@ -0,0 +1,102 @@
+/** Test of the tracking of grid_medium against the analytic transmittance
+
+    In a uniform grid the transmittance along a segment is exp(-density *
+    length). Rays crossing the grid along an axis, along a diagonal through
+    many majorant cells, and with a direction that is not normalized, must
+    give this transmittance on average, both with the ratio tracking of
+    transmittance() and as the fraction of the rays going through without a
+    collision sampled by the delta tracking of hit().
+*/
+#include "sycl.hpp"
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "grid_medium.hpp"
+#include "render.hpp"
+
+namespace {
+
+/// Like the task_context of the kernels, with a host pointer to the voxels
+struct test_context {
+  LocalPseudoRNG rng;
+  const std::uint8_t* texture_data;
+  instrumentation::no_counters counters {};
+};
+
+/// Estimates per ray, enough for an error of about 0.002
+constexpr int nb_samples = 100000;
+
+/** Compare the estimates of the transmittance of a ray with its expected
+    value, printing an error if one of them is more than 5 standard errors
+    away
+
+    \param[in] length is the length of the ray in the medium
+*/
+bool check(const char* name, const grid_medium& medium, test_context& ctx,
+           const ray& r, real_t length, real_t density) {
+  const double expected = std::exp(-density * length);
+  double sum = 0, sum2 = 0;
+  int escaped = 0;
+  for (int i = 0; i < nb_samples; ++i) {
+    const double t = medium.transmittance(ctx, r, 0, infinity);
+    sum += t;
+    sum2 += t * t;
+    hit_record rec;
+    if (!medium.hit(ctx, r, 0, infinity, rec))
+      ++escaped;
+  }
+  const auto ratio = sum / nb_samples;
+  const auto ratio_error =
+      std::sqrt((sum2 / nb_samples - ratio * ratio) / nb_samples);
+  const auto delta = static_cast<double>(escaped) / nb_samples;
+  const auto delta_error = std::sqrt(expected * (1 - expected) / nb_samples);
+  std::cerr << name << ": expected " << expected << ", ratio tracking "
+            << ratio << " +- " << ratio_error << ", delta tracking " << delta
+            << " +- " << delta_error << std::endl;
+  bool passed = true;
+  if (std::abs(ratio - expected) > 5 * ratio_error) {
+    std::cerr << "ERROR: The ratio tracking of the " << name
+              << " ray does not give the transmittance." << std::endl;
+    passed = false;
+  }
+  if (std::abs(delta - expected) > 5 * delta_error) {
+    std::cerr << "ERROR: The delta tracking of the " << name
+              << " ray does not give the transmittance." << std::endl;
+    passed = false;
+  }
+  return passed;
+}
+
+} // namespace
+
+int main() {
+  // A box of side 2 filled with 40^3 voxels, that is 5^3 majorant cells, of
+  // density 0.5
+  constexpr std::uint32_t grid = 40;
+  constexpr real_t density = 0.5f;
+  texture_table data;
+  const grid_medium medium { { point { -1, -1, -1 }, point { 1, 1, 1 } },
+                             density,
+                             grid,
+                             grid,
+                             grid,
+                             std::vector<std::uint8_t>(grid * grid * grid, 255),
+                             data,
+                             0 };
+  auto data_buf = data.freeze();
+  auto data_acc = data_buf.get_access<sycl::access::mode::read>();
+  test_context ctx { LocalPseudoRNG {}, &data_acc[0][0] };
+
+  const auto diagonal = unit_vector(vec { 1, 1, 1 });
+  const bool passed =
+      check("axis", medium, ctx, ray { point { -3, 0.1f, 0.2f }, vec { 1, 0, 0 } },
+            2, density) &
+      check("diagonal", medium, ctx,
+            ray { point { 0, 0, 0 } - 3 * diagonal, diagonal },
+            2 * std::sqrt(3.f), density) &
+      check("scaled", medium, ctx,
+            ray { point { 0.3f, -3, -0.4f }, vec { 0, 4, 0 } }, 2, density);
+  return passed ? 0 : 1;
+}
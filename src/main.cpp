@@ -2,75 +2,146 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
-#include <iterator>
-#include <math.h>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb/stb_image_write.h>
-
+#include "image_writer.hpp"
 #include "render.hpp"
+#include "scene.hpp"
+#include "tonemap.hpp"
 
-// Function to save image data in ppm format
-void dump_image_ppm(int width, int height, auto& fb_data) {
-  std::cout << "P3\n" << width << " " << height << "\n255\n";
-  for (int y = height - 1; y >= 0; y--) {
-    for (int x = 0; x < width; x++) {
-      auto pixel_index = y * width + x;
-      int r = static_cast<int>(
-          256 * std::clamp(sycl::sqrt(fb_data[pixel_index].x()), 0.0f, 0.999f));
-      int g = static_cast<int>(
-          256 * std::clamp(sycl::sqrt(fb_data[pixel_index].y()), 0.0f, 0.999f));
-      int b = static_cast<int>(
-          256 * std::clamp(sycl::sqrt(fb_data[pixel_index].z()), 0.0f, 0.999f));
-      std::cout << r << " " << g << " " << b << "\n";
-    }
-  }
+/** Write the accumulated image to out.png or the other chosen format,
+    printing the time of the resolve to 8-bit pixels on the device, including
+    their transfer, and of the encoding
+*/
+void save_image(sycl::queue& queue, accumulation_buffer& accum,
+                image_writer::format format,
+                const tonemap::parameters& tonemapping) {
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+  const auto image = tonemap::resolve(queue, accum, tonemapping,
+                                      image_writer::is_hdr(format));
+  const auto resolved = clock::now();
+  const auto file_name = std::string { "out" } + image_writer::extension(format);
+  image_writer::write(file_name.c_str(), image, format);
+  const auto written = clock::now();
+  auto ms = [](auto d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  std::cerr << "resolve: " << ms(resolved - start)
+            << " ms, encode and write " << file_name << ": "
+            << ms(written - resolved) << " ms" << std::endl;
 }
 
-void save_image_png(int width, int height, sycl::buffer<color, 2> &fb) {
-  constexpr unsigned num_channels = 3;
-  auto fb_data = fb.get_access<sycl::access::mode::read>();
-
-  std::vector<uint8_t> pixels;
-  pixels.resize(width * height * num_channels);
-
-  int index = 0;
-  for (int j = height - 1; j >= 0; --j) {
-    for (int i = 0; i < width; ++i) {
-      auto input_index = j * width + i;
-      int r = static_cast<int>(
-          256 * std::clamp(sycl::sqrt(fb_data[j][i].x()), 0.0f, 0.999f));
-      int g = static_cast<int>(
-          256 * std::clamp(sycl::sqrt(fb_data[j][i].y()), 0.0f, 0.999f));
-      int b = static_cast<int>(
-          256 * std::clamp(sycl::sqrt(fb_data[j][i].z()), 0.0f, 0.999f));
-
-      pixels[index++] = r;
-      pixels[index++] = g;
-      pixels[index++] = b;
-    }
-  }
+/// The animation rendered by render_sequence()
+struct sequence_parameters {
+  /// Number of frames, a single image being rendered with 1
+  int frames = 1;
+  /// Time between the shutter openings of 2 frames, 0 for the shutter
+  /// duration of the camera
+  real_t frame_time = 0;
+  /// Angle in degrees turned by the camera around look_at over the sequence
+  real_t orbit = 0;
+};
 
-  stbi_write_png("out.png", width, height, num_channels, pixels.data(),
-                 width * num_channels);
+/// Name of the image file of a frame of a sequence, such as out_0042.png
+std::string frame_file_name(int frame, image_writer::format format) {
+  char number[16];
+  std::snprintf(number, sizeof number, "_%04d", frame);
+  return std::string { "out" } + number + image_writer::extension(format);
 }
 
-int main() {
-  // Frame buffer dimensions
-  constexpr auto width = buildparams::output_width;
-  constexpr auto height = buildparams::output_height;
+/** Render the frames of an animation with the scene staying on the device
+
+    For each frame, the camera turns by its share of the orbit and its
+    shutter moves by the frame time, the BVH of the moving primitives being
+    refitted to the new shutter interval instead of uploading the scene
+    again. The image of a frame is resolved on the device and then encoded
+    and written by a host thread while the next frame renders.
 
-  /// Graphical objects
-  std::vector<hittable_t> hittables;
+    \param[out] accum is left with the last frame
+*/
+void render_sequence(sycl::queue& queue, scene& world,
+                     const sequence_parameters& sequence,
+                     accumulation_buffer& accum,
+                     const render_parameters& params, int passes,
+                     const adaptive_sampling& adaptive, bool generic,
+                     image_writer::format format,
+                     const tonemap::parameters& tonemapping) {
+  using clock = std::chrono::steady_clock;
+  auto ms = [](auto d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  const auto frame_time = sequence.frame_time > 0
+                              ? sequence.frame_time
+                              : world.view.time1 - world.view.time0;
+  const auto& texture_pages = world.page_store();
+  /// Writes the previous frame while the current one renders
+  std::thread writer;
+  /// Time spent by the writer, only read once it is joined
+  double encode_time = 0;
+  const auto start = clock::now();
+  for (int frame = 0; frame < sequence.frames; ++frame) {
+    const auto frame_start = clock::now();
+    auto view = world.view;
+    if (sequence.orbit != 0)
+      view.orbit(sequence.orbit * frame / sequence.frames);
+    view.time0 += frame * frame_time;
+    view.time1 += frame * frame_time;
+    world.set_shutter(view.time0, view.time1);
+    const auto cam = view.make_camera(static_cast<real_t>(params.width) /
+                                      params.height);
+    accum.clear();
+    if (texture_pages.page_count()) {
+      // Load the texture pages seen from the new point of view, see main()
+      accumulation_buffer warm_up { accum.width(), accum.height() };
+      auto warm_up_params = params;
+      warm_up_params.samples = 1;
+      world.render(queue, cam, warm_up, warm_up_params, {}, generic);
+    }
+    for (int pass = 0; pass < passes && accum.active_pixels; ++pass)
+      world.render(queue, cam, accum, params, adaptive, generic);
+    auto image = tonemap::resolve(queue, accum, tonemapping,
+                                  image_writer::is_hdr(format));
+    const auto rendered = clock::now();
+    // Only one frame is written at a time, which bounds the memory used by
+    // the images waiting to be written
+    if (writer.joinable())
+      writer.join();
+    writer = std::thread { [&encode_time, ms, format,
+                            file_name = frame_file_name(frame, format),
+                            image = std::move(image)] {
+      const auto encode_start = clock::now();
+      image_writer::write(file_name.c_str(), image, format);
+      encode_time += ms(clock::now() - encode_start);
+    } };
+    std::cerr << "frame " << frame << ": " << ms(rendered - frame_start)
+              << " ms" << std::endl;
+  }
+  if (writer.joinable())
+    writer.join();
+  const auto total = ms(clock::now() - start);
+  std::cerr << "sequence: " << sequence.frames << " frames in " << total
+            << " ms, " << total / sequence.frames << " ms per frame, "
+            << encode_time << " ms of encoding overlapped with rendering"
+            << std::endl;
+}
 
+/// Add the built-in scene, used when no scene file is given
+void build_default_scene(scene& world) {
+  auto& hittables = world.hittables;
+  auto& materials = world.materials;
   // Generating a checkered ground and some random spheres
   texture_t t =
       checker_texture(color { 0.2f, 0.3f, 0.1f }, color { 0.9f, 0.9f, 0.9f });
   material_t m = lambertian_material(t);
-  hittables.emplace_back(sphere(point { 0, -1000, 0 }, 1000, m));
+  hittables.add(sphere(point { 0, -1000, 0 }, 1000, materials.add(m)));
   t = checker_texture(color { 0.9f, 0.9f, 0.9f }, color { 0.4f, 0.2f, 0.1f });
 
   LocalPseudoRNG rng;
@@ -85,113 +156,363 @@ int main() {
         if (choose_mat < 0.4f) {
           // Lambertian
           auto albedo = rng.vec_t() * rng.vec_t();
-          hittables.emplace_back(
-              sphere(center, 0.2f, lambertian_material(albedo)));
+          hittables.add(
+              sphere(center, 0.2f, materials.add(lambertian_material(albedo))));
         } else if (choose_mat < 0.8f) {
           // Lambertian movig spheres
           auto albedo = rng.vec_t() * rng.vec_t();
           auto center2 = center + point { 0, rng.float_t(0, 0.25f), 0 };
-          hittables.emplace_back(sphere(center, center2, 0.0f, 1.0f, 0.2f,
-                                        lambertian_material(albedo)));
+          hittables.add(
+              sphere(center, center2, 0.0f, 1.0f, 0.2f,
+                     materials.add(lambertian_material(albedo))));
         } else if (choose_mat < 0.95f) {
           // metal
           auto albedo = rng.vec_t(0.5f, 1);
           auto fuzz = rng.float_t(0, 0.5f);
-          hittables.emplace_back(
-              sphere(center, 0.2f, metal_material(albedo, fuzz)));
+          hittables.add(
+              sphere(center, 0.2f, materials.add(metal_material(albedo, fuzz))));
         } else {
           // glass
-          hittables.emplace_back(
-              sphere(center, 0.2f,
-                     dielectric_material(1.5f, color { 1.0f, 1.0f, 1.0f })));
+          hittables.add(sphere(
+              center, 0.2f,
+              materials.add(
+                  dielectric_material(1.5f, color { 1.0f, 1.0f, 1.0f }))));
         }
       }
     }
   }
 
   // Pyramid
-  hittables.emplace_back(
+  hittables.add(
       triangle(point { 6.5f, 0.0f, 1.30f }, point { 6.25f, 0.50f, 1.05f },
                point { 6.5f, 0.0f, 0.80f },
-               lambertian_material(color(0.68f, 0.50f, 0.1f))));
-  hittables.emplace_back(
+               materials.add(lambertian_material(color(0.68f, 0.50f, 0.1f)))));
+  hittables.add(
       triangle(point { 6.0f, 0.0f, 1.30f }, point { 6.25f, 0.50f, 1.05f },
                point { 6.5f, 0.0f, 1.30f },
-               lambertian_material(color(0.89f, 0.73f, 0.29f))));
-  hittables.emplace_back(triangle(
-      point { 6.5f, 0.0f, 0.80f }, point { 6.25f, 0.50f, 1.05f },
-      point { 6.0f, 0.0f, 0.80f }, lambertian_material(color(0.0f, 0.0f, 1))));
-  hittables.emplace_back(triangle(
-      point { 6.0f, 0.0f, 0.80f }, point { 6.25f, 0.50f, 1.05f },
-      point { 6.0f, 0.0f, 1.30f }, lambertian_material(color(0.0f, 0.0f, 1))));
+               materials.add(lambertian_material(color(0.89f, 0.73f, 0.29f)))));
+  // The two blue faces share the same material
+  hittables.add(
+      triangle(point { 6.5f, 0.0f, 0.80f }, point { 6.25f, 0.50f, 1.05f },
+               point { 6.0f, 0.0f, 0.80f },
+               materials.add(lambertian_material(color(0.0f, 0.0f, 1)))));
+  hittables.add(
+      triangle(point { 6.0f, 0.0f, 0.80f }, point { 6.25f, 0.50f, 1.05f },
+               point { 6.0f, 0.0f, 1.30f },
+               materials.add(lambertian_material(color(0.0f, 0.0f, 1)))));
 
   // Glowing ball
-  hittables.emplace_back(
-      sphere(point { 4, 1, 0 }, 0.2f, lightsource_material(color(10, 0, 10))));
+  hittables.add(
+      sphere(point { 4, 1, 0 }, 0.2f,
+             materials.add(lightsource_material(color(10, 0, 10)))));
 
   // Four large spheres of metal, dielectric and Lambertian material types
-  t = image_texture::image_texture_factory("../images/Xilinx.jpg");
-  hittables.emplace_back(xy_rect(2, 4, 0, 1, -1, lambertian_material(t)));
-  hittables.emplace_back(
-      sphere(point { 4, 1, 2.25f }, 1, lambertian_material(t)));
-  hittables.emplace_back(
-      sphere(point { 0, 1, 0 }, 1,
-             dielectric_material(1.5f, color { 1.0f, 0.5f, 0.5f })));
-  hittables.emplace_back(sphere(point { -4, 1, 0 }, 1,
-                                lambertian_material(color(0.4f, 0.2f, 0.1f))));
-  hittables.emplace_back(sphere(point { 0, 1, -2.25f }, 1,
-                                metal_material(color(0.7f, 0.6f, 0.5f), 0.0f)));
-
-  t = image_texture::image_texture_factory("../images/SYCL.png", 5);
+  t = world.textures.add_image("../images/Xilinx.jpg");
+  auto xilinx = materials.add(lambertian_material(t));
+  hittables.add(xy_rect(2, 4, 0, 1, -1, xilinx));
+  hittables.add(sphere(point { 4, 1, 2.25f }, 1, xilinx));
+  hittables.add(sphere(
+      point { 0, 1, 0 }, 1,
+      materials.add(dielectric_material(1.5f, color { 1.0f, 0.5f, 0.5f }))));
+  hittables.add(
+      sphere(point { -4, 1, 0 }, 1,
+             materials.add(lambertian_material(color(0.4f, 0.2f, 0.1f)))));
+  hittables.add(
+      sphere(point { 0, 1, -2.25f }, 1,
+             materials.add(metal_material(color(0.7f, 0.6f, 0.5f), 0.0f))));
+
+  t = world.textures.add_image("../images/SYCL.png", 5);
 
   // // Add a sphere with a SYCL logo in the background
-  hittables.emplace_back(
-      sphere { point { -60, 3, 5 }, 4, lambertian_material { t } });
+  hittables.add(sphere { point { -60, 3, 5 }, 4,
+                                  materials.add(lambertian_material { t }) });
 
   // Add a metallic monolith
-  hittables.emplace_back(
+  hittables.add(
       box { point { 6.5f, 0, -1.5f }, point { 7.0f, 3.0f, -1.0f },
-            metal_material { color { 0.7f, 0.6f, 0.5f }, 0.25f } });
+            materials.add(
+                metal_material { color { 0.7f, 0.6f, 0.5f }, 0.25f }) });
 
   // Add a smoke ball
   sphere smoke_sphere =
       sphere { point { 5, 1, 3.5f }, 1,
-               lambertian_material { color { 0.75f, 0.75f, 0.75f } } };
-  hittables.emplace_back(
-      constant_medium { smoke_sphere, 1, color { 1, 1, 1 } });
+               materials.add(
+                   lambertian_material { color { 0.75f, 0.75f, 0.75f } }) };
+  hittables.add(constant_medium {
+      smoke_sphere, 1,
+      materials.add(isotropic_material { color { 1, 1, 1 } }) });
+}
+
+void usage(const char* program) {
+  std::cerr << "Usage: " << program << " [options]\n"
+            << "  --width <n>          image width (" << buildparams::output_width
+            << ")\n"
+            << "  --height <n>         image height ("
+            << buildparams::output_height << ")\n"
+            << "  --samples <n>        samples per pixel in each pass (10)\n"
+            << "  --depth <n>          maximum number of bounces of a path (50)\n"
+            << "  --roulette-depth <n> bounces before Russian roulette (3)\n"
+            << "  --no-light-sampling  only find the lights by bouncing\n"
+            << "  --generic            do not use the specialized kernels\n"
+            << "  --scene <file>       load the scene from a file instead of\n"
+            << "                       the built-in one\n"
+            << "  --scene-cache <file> map the scene from this binary cache, or\n"
+            << "                       write it when missing or written from\n"
+            << "                       another scene or version of it\n"
+            << "  --texture-cache <dir> keep the decoded texture images in\n"
+            << "                       this directory for the next runs\n"
+            << "  --texture-pool <MiB> stream the large texture images from\n"
+            << "                       the texture cache through a pool of\n"
+            << "                       this size\n"
+            << "  --passes <n>         number of rendering passes (10)\n"
+            << "  --preview            write out.png after each pass\n"
+            << "  --format <format>    png, qoi, ppm or hdr (png)\n"
+            << "  --exposure <x>       scale of the colors (1)\n"
+            << "  --tonemap <op>       clamp, reinhard or aces (clamp)\n"
+            << "  --checkpoint <file>  save the render state after each pass\n"
+            << "  --resume <file>      resume from a checkpoint\n"
+            << "  --adaptive <error>   stop sampling the pixels whose relative\n"
+            << "                       standard error is below <error>\n"
+            << "  --frames <n>         render an animation of n frames to\n"
+            << "                       out_0000.png, out_0001.png...\n"
+            << "  --frame-time <t>     time between 2 frames (the shutter\n"
+            << "                       duration of the camera)\n"
+            << "  --orbit <degrees>    turn the camera around look_at over\n"
+            << "                       the frames\n";
+  if constexpr (buildparams::use_instrumentation)
+    std::cerr << "  --cost-image         write the intersection tests per pixel\n"
+              << "                       to out_cost.png\n";
+}
+
+int main(int argc, char* argv[]) {
+  /// Frame buffer dimensions, samples per pixel and per pass and path depth
+  render_parameters params;
+  /// Always use the kernel taking the parameters at run time, to compare it
+  /// with the specialized kernels
+  bool generic = false;
+
+  /// Number of passes, the total number of samples per pixel being
+  /// passes * params.samples
+  int passes = 10;
+  /// Write the image after each pass to follow the progress
+  bool preview = false;
+  /// Format of the output image
+  auto format = image_writer::format::png;
+  /// Conversion of the colors to 8-bit pixels
+  tonemap::parameters tonemapping;
+  /// Scene file, the built-in scene being used without it
+  const char* scene_file = nullptr;
+  /// Binary cache of the scene, see scene_cache.hpp
+  const char* cache_file = nullptr;
+  /// Directory of the decoded texture images, not cached without it
+  const char* texture_cache = nullptr;
+  /// Size of the pool of texture pages in MiB, not streaming if 0
+  double texture_pool = 0;
+  /// File where to save the render state after each pass
+  const char* checkpoint_file = nullptr;
+  /// Checkpoint file to resume from
+  const char* resume_file = nullptr;
+  /// Adaptive sampling, disabled by default
+  adaptive_sampling adaptive;
+  /// With instrumentation, also write an image of the cost of each pixel
+  bool cost_image = false;
+  /// The frames to render, a single image by default
+  sequence_parameters sequence;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg { argv[i] };
+    if (arg == "--width" && i + 1 < argc)
+      params.width = std::atoi(argv[++i]);
+    else if (arg == "--height" && i + 1 < argc)
+      params.height = std::atoi(argv[++i]);
+    else if (arg == "--samples" && i + 1 < argc)
+      params.samples = std::atoi(argv[++i]);
+    else if (arg == "--depth" && i + 1 < argc)
+      params.depth = std::atoi(argv[++i]);
+    else if (arg == "--roulette-depth" && i + 1 < argc)
+      params.roulette_depth = std::atoi(argv[++i]);
+    else if (arg == "--no-light-sampling")
+      params.light_sampling = false;
+    else if (arg == "--generic")
+      generic = true;
+    else if (arg == "--passes" && i + 1 < argc)
+      passes = std::atoi(argv[++i]);
+    else if (arg == "--preview")
+      preview = true;
+    else if (arg == "--format" && i + 1 < argc &&
+             image_writer::parse_format(argv[i + 1], format))
+      ++i;
+    else if (arg == "--exposure" && i + 1 < argc)
+      tonemapping.exposure = std::atof(argv[++i]);
+    else if (arg == "--tonemap" && i + 1 < argc &&
+             tonemap::parse_operator(argv[i + 1], tonemapping.op))
+      ++i;
+    else if (arg == "--scene" && i + 1 < argc)
+      scene_file = argv[++i];
+    else if (arg == "--scene-cache" && i + 1 < argc)
+      cache_file = argv[++i];
+    else if (arg == "--texture-cache" && i + 1 < argc)
+      texture_cache = argv[++i];
+    else if (arg == "--texture-pool" && i + 1 < argc)
+      texture_pool = std::atof(argv[++i]);
+    else if (arg == "--checkpoint" && i + 1 < argc)
+      checkpoint_file = argv[++i];
+    else if (arg == "--resume" && i + 1 < argc)
+      resume_file = argv[++i];
+    else if (arg == "--adaptive" && i + 1 < argc)
+      adaptive.threshold = std::atof(argv[++i]);
+    else if (arg == "--frames" && i + 1 < argc)
+      sequence.frames = std::atoi(argv[++i]);
+    else if (arg == "--frame-time" && i + 1 < argc)
+      sequence.frame_time = std::atof(argv[++i]);
+    else if (arg == "--orbit" && i + 1 < argc)
+      sequence.orbit = std::atof(argv[++i]);
+    else if (buildparams::use_instrumentation && arg == "--cost-image")
+      cost_image = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (params.width <= 0 || params.height <= 0 || params.samples <= 0 ||
+      params.depth <= 0) {
+    std::cerr << "ERROR: The image size, samples and depth must be positive."
+              << std::endl;
+    return 1;
+  }
+  if (params.roulette_depth < 0) {
+    std::cerr << "ERROR: The Russian roulette depth cannot be negative."
+              << std::endl;
+    return 1;
+  }
+  if (!(tonemapping.exposure > 0)) {
+    std::cerr << "ERROR: The exposure must be positive." << std::endl;
+    return 1;
+  }
+  if (sequence.frames <= 0 || sequence.frame_time < 0) {
+    std::cerr << "ERROR: The number of frames must be positive and the "
+                 "frame time cannot be negative."
+              << std::endl;
+    return 1;
+  }
+  if (sequence.frames > 1 && (checkpoint_file || resume_file || preview)) {
+    std::cerr << "ERROR: A sequence of frames cannot be checkpointed, "
+                 "resumed or previewed."
+              << std::endl;
+    return 1;
+  }
+  /// The scene and everything it owns
+  scene world;
+  if (texture_cache && !world.textures.set_cache_directory(texture_cache))
+    return 1;
+  if (texture_pool < 0 || (texture_pool > 0 && !texture_cache)) {
+    std::cerr << "ERROR: The texture pool must be positive and needs a "
+                 "texture cache."
+              << std::endl;
+    return 1;
+  }
+  if (texture_pool > 0 && cache_file) {
+    std::cerr << "ERROR: Streamed textures cannot be stored in a scene cache."
+              << std::endl;
+    return 1;
+  }
+  world.textures.set_pool_size(
+      static_cast<std::size_t>(texture_pool * 1024 * 1024));
+  const auto width = params.width;
+  const auto height = params.height;
+
+  using clock = std::chrono::steady_clock;
+  auto ms = [](auto d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  const auto scene_start = clock::now();
+  if (cache_file &&
+      scene_cache<scene_hittables>::is_fresh(cache_file, scene_file) &&
+      world.map_cache(cache_file)) {
+    std::cerr << "scene: " << world.size() << " primitives mapped from "
+              << cache_file << std::endl;
+  } else {
+    if (scene_file) {
+      if (!world.load(scene_file))
+        return 1;
+      std::cerr << "scene: " << world.size() << " primitives and "
+                << world.materials.size() << " materials loaded from "
+                << scene_file << " in " << ms(clock::now() - scene_start)
+                << " ms" << std::endl;
+    } else
+      build_default_scene(world);
+    print_memory_report(std::cerr, world.hittables);
+    world.upload();
+    if (cache_file)
+      world.save_cache(cache_file, scene_file);
+  }
+  std::cerr << "scene setup: " << ms(clock::now() - scene_start) << " ms"
+            << std::endl;
 
   // SYCL queue
   sycl::queue myQueue;
 
   // Camera setup
-  /// Position of the camera
-  point look_from { 13, 3, 3 };
-  /// The center of the scene
-  point look_at { 0, -1, 0 };
-  // Make the camera oriented upwards
-  vec vup { 0, 1, 0 };
-
-  /// Vertical angle of view in degree
-  real_t angle = 40;
-  // Lens aperture. 0 if not depth-of-field
-  real_t aperture = 0.04f;
-  // Make the focus on the point we are looking at
-  real_t focus_dist = length(look_at - look_from);
-  camera cam {
-    look_from, look_at,    vup,  angle, static_cast<real_t>(width) / height,
-    aperture,  focus_dist, 0.0f, 1.0f
-  };
+  camera cam = world.view.make_camera(static_cast<real_t>(width) / height);
+  accumulation_buffer accum { static_cast<std::size_t>(width),
+                              static_cast<std::size_t>(height) };
+  if (resume_file && !accum.load(resume_file, params, scene_file))
+    return 1;
 
-  // Sample per pixel
-  constexpr auto samples = 100;
+  const auto& texture_pages = world.page_store();
+  if (sequence.frames > 1)
+    render_sequence(myQueue, world, sequence, accum, params, passes, adaptive,
+                    generic, format, tonemapping);
+  else {
+    if (texture_pages.page_count()) {
+      // Load the texture pages seen by the camera with a pass whose samples
+      // are dropped, instead of accumulating the coarse levels used in place
+      // of the missing pages
+      accumulation_buffer warm_up { accum.width(), accum.height() };
+      auto warm_up_params = params;
+      warm_up_params.samples = 1;
+      world.render(myQueue, cam, warm_up, warm_up_params, {}, generic);
+    }
 
-  // SYCL render kernel
+    for (int pass = accum.sample_count / params.samples; pass < passes;
+         ++pass) {
+      // SYCL render kernel, progressively adding samples
+      world.render(myQueue, cam, accum, params, adaptive, generic);
+      if (checkpoint_file)
+        accum.save(checkpoint_file, params, scene_file);
+      // No need to go on once every pixel has converged
+      if (accum.active_pixels == 0)
+        break;
+      if (preview && pass + 1 < passes)
+        save_image(myQueue, accum, format, tonemapping);
+    }
+    accum.print_sample_statistics(std::cerr);
+  }
+  if (texture_pages.page_count())
+    texture_pages.print_statistics(std::cerr);
 
-  sycl::buffer<color, 2> fb(sycl::range<2>(height, width));
-  render<width, height, samples>(myQueue, fb, hittables, cam);
+  // Save image to file, the frames of a sequence being already written
+  if (sequence.frames == 1)
+    save_image(myQueue, accum, format, tonemapping);
 
-  // Save image to file
-  save_image_png(width, height, fb);
+  if constexpr (buildparams::use_instrumentation) {
+    std::ofstream json { "counters.json" };
+    instrumentation::write_json(json, accum.counters);
+    if (!json)
+      std::cerr << "ERROR: Could not write 'counters.json'." << std::endl;
+    if (cost_image) {
+      const image_writer::byte_image image {
+        static_cast<std::size_t>(width), static_cast<std::size_t>(height), 3,
+        instrumentation::cost_image(accum.counters,
+                                    instrumentation::intersection_tests)
+      };
+      // An 8-bit false color map, so always a PNG image whatever the format
+      // of the rendered one. write() prints the error
+      if (!image_writer::write("out_cost.png", image,
+                               image_writer::format::png))
+        return 1;
+    }
+  }
 
   return 0;
 }
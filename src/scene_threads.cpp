@@ -0,0 +1,134 @@
+/** Test of the rendering of independent scenes in parallel
+
+    Two scenes with their own objects, materials and textures are each
+    built, rendered and destroyed once alone, then both at the same time,
+    each by its own thread with its own queue. Since nothing is shared
+    between the scenes, the concurrent renders must be identical to the
+    sequential ones.
+
+    The image texture is read from the file given as argument, by default
+    the one of the repository when run from the build directory.
+*/
+#include "sycl.hpp"
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "scene.hpp"
+
+namespace {
+
+/// Small images with few samples, enough to go through every primitive
+const render_parameters params { 64, 48, 4, 8 };
+
+/// Spheres on a checkered ground, some of them moving
+void build_spheres(scene& world) {
+  auto& materials = world.materials;
+  world.hittables.add(
+      sphere(point { 0, -1000, 0 }, 1000,
+             materials.add(lambertian_material(
+                 checker_texture(color { 0.2f, 0.3f, 0.1f },
+                                 color { 0.9f, 0.9f, 0.9f })))));
+  world.hittables.add(sphere(point { 0, 1, 0 }, 1,
+                             materials.add(dielectric_material(
+                                 1.5f, color { 1.0f, 1.0f, 1.0f }))));
+  world.hittables.add(
+      sphere(point { -4, 1, 0 }, 1,
+             materials.add(lambertian_material(color { 0.4f, 0.2f, 0.1f }))));
+  world.hittables.add(
+      sphere(point { 4, 1, 0 }, 1,
+             materials.add(metal_material(color { 0.7f, 0.6f, 0.5f }, 0))));
+  world.hittables.add(
+      sphere(point { 2, 0.2f, 2 }, point { 2, 0.5f, 2 }, 0, 1, 0.2f,
+             materials.add(lambertian_material(color { 0.1f, 0.2f, 0.5f }))));
+}
+
+/// A textured sphere and a triangle lit by a rectangular light
+void build_textured(scene& world, const char* image_file) {
+  auto& materials = world.materials;
+  world.view.look_from = point { 0, 2, 8 };
+  world.view.look_at = point { 0, 1, 0 };
+  world.view.aperture = 0;
+  world.hittables.add(
+      sphere(point { 0, 1, 0 }, 1,
+             materials.add(
+                 lambertian_material(world.textures.add_image(image_file)))));
+  world.hittables.add(
+      triangle(point { -3, 0, -2 }, point { 3, 0, -2 }, point { 0, 3, -3 },
+               materials.add(lambertian_material(color { 0.7f, 0.7f, 0.7f }))));
+  world.hittables.add(
+      xz_rect(-6, 6, -6, 6, 0,
+              materials.add(lambertian_material(color { 0.5f, 0.5f, 0.5f }))));
+  world.hittables.add(
+      xz_rect(-1, 1, -1, 1, 4,
+              materials.add(lightsource_material(color { 10, 10, 10 }))));
+}
+
+/** Build and upload a scene, render its passes to a new accumulation buffer
+    and return its sums, the scene being destroyed on return
+
+    \param[in] build fills the tables of the scene
+*/
+std::vector<color> render(sycl::queue& queue, auto&& build, int passes) {
+  scene world;
+  build(world);
+  world.upload();
+  accumulation_buffer accum { static_cast<std::size_t>(params.width),
+                              static_cast<std::size_t>(params.height) };
+  const auto cam = world.view.make_camera(static_cast<real_t>(params.width) /
+                                          params.height);
+  for (int pass = 0; pass < passes; ++pass)
+    world.render(queue, cam, accum, params);
+  auto sum = accum.sum.get_access<sycl::access::mode::read>();
+  std::vector<color> pixels;
+  for (int y = 0; y < params.height; ++y)
+    for (int x = 0; x < params.width; ++x)
+      pixels.push_back(sum[y][x]);
+  return pixels;
+}
+
+/// Tell whether two renders are bitwise identical, printing an error if not
+bool same(const char* name, const std::vector<color>& expected,
+          const std::vector<color>& actual) {
+  if (expected.size() == actual.size() &&
+      std::memcmp(expected.data(), actual.data(),
+                  expected.size() * sizeof(color)) == 0)
+    return true;
+  std::cerr << "ERROR: The concurrent render of the " << name
+            << " scene differs from its sequential render." << std::endl;
+  return false;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const char* image_file = argc > 1 ? argv[1] : "../images/Xilinx.jpg";
+  constexpr int passes = 2;
+
+  auto textured = [&](scene& world) { build_textured(world, image_file); };
+
+  sycl::queue queue;
+  const auto spheres_alone = render(queue, build_spheres, passes);
+  const auto textured_alone = render(queue, textured, passes);
+
+  std::vector<color> spheres_concurrent, textured_concurrent;
+  std::thread spheres_thread { [&] {
+    sycl::queue q;
+    spheres_concurrent = render(q, build_spheres, passes);
+  } };
+  std::thread textured_thread { [&] {
+    sycl::queue q;
+    textured_concurrent = render(q, textured, passes);
+  } };
+  spheres_thread.join();
+  textured_thread.join();
+
+  const bool passed = same("spheres", spheres_alone, spheres_concurrent) &
+                      same("textured", textured_alone, textured_concurrent);
+  if (passed)
+    std::cerr << "scenes rendered concurrently match their sequential renders"
+              << std::endl;
+  return passed ? 0 : 1;
+}